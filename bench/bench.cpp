@@ -0,0 +1,65 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+#include "dish/utils.hpp"
+
+#include <stdlib.h>
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace dish::bench
+{
+  std::string home;
+
+  void init()
+  {
+    char dir[] = "/tmp/dish-bench-XXXXXX";
+    if (mkdtemp(dir) == nullptr)
+    {
+      fmt::println(stderr, "mkdtemp: {}", strerror(errno));
+      std::exit(1);
+    }
+    home = dir;
+    std::filesystem::create_directories(home + "/.config/dish");
+    std::ofstream{home + "/.config/dish/config.lua"};
+    setenv("HOME", home.c_str(), 1);
+    std::atexit([] { std::filesystem::remove_all(home); });
+    dish_init(false);
+  }
+
+  std::size_t get_count(int argc, char **argv, std::size_t def)
+  {
+    if (argc < 2)
+      return def;
+    std::size_t n = 0;
+    auto [end, ec] = std::from_chars(argv[1], argv[1] + std::strlen(argv[1]), n);
+    if (ec != std::errc{} || *end != '\0' || n == 0)
+    {
+      fmt::println(stderr, "usage: {} [count]", argv[0]);
+      std::exit(2);
+    }
+    return n;
+  }
+
+  void report(std::string_view name, double us)
+  {
+    fmt::println("{:<36} {:>12.3f} us {:>14.0f} /s", name, us, 1e6 / us);
+  }
+}// namespace dish::bench
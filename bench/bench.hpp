@@ -0,0 +1,45 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_BENCH_HPP
+#define DISH_BENCH_HPP
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+// The benchmarks link the objects of dish and call it directly. Each takes an optional count
+// of iterations as its first argument.
+namespace dish::bench
+{
+  // Starts dish as for a script, with an empty config.lua in a temporary HOME, so the aliases
+  // and settings of the user do not change the results.
+  void init();
+
+  std::size_t get_count(int argc, char **argv, std::size_t def);
+
+  // Runs f n times, returns the microseconds of one run.
+  template<typename F>
+  double measure(std::size_t n, F &&f)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i)
+      f();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / static_cast<double>(n);
+  }
+
+  void report(std::string_view name, double us);
+}// namespace dish::bench
+#endif
@@ -0,0 +1,48 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/arithmetic.hpp"
+#include "dish/dish.hpp"
+#include "dish/expansion.hpp"
+#include "dish/variable.hpp"
+
+#include <algorithm>
+#include <string>
+
+using namespace dish;
+
+// $(( )) against what scripts used before it: a Lua chunk compiled for each evaluation, or
+// an expr process.
+int main(int argc, char **argv)
+{
+  auto n = bench::get_count(argc, argv, 200000);
+  bench::init();
+
+  long long result;
+  variable::variable_table.set("i", "1");
+  bench::report("arithmetic::evaluate", bench::measure(n, [&result]
+                                                       { arithmetic::evaluate("i = (i + 3) * 2 % 1000003", result); }));
+  std::string out;
+  bench::report("expansion::expand $((...))", bench::measure(n, [&out]
+                                                             {
+                                                               out.clear();
+                                                               expansion::expand("$((i = (i + 3) * 2 % 1000003))", out);
+                                                             }));
+  dish_context.lua_state["i"] = 1;
+  bench::report("Lua chunk", bench::measure(std::max<std::size_t>(n / 10, 1), []
+                                            { dish_context.lua_state.script("i = (i + 3) * 2 % 1000003"); }));
+  bench::report("expr 41 + 1", bench::measure(std::max<std::size_t>(n / 1000, 1), []
+                                              { run_command("expr 41 + 1 > /dev/null"); }));
+  return 0;
+}
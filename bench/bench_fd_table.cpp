@@ -0,0 +1,110 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+
+using namespace dish;
+
+namespace
+{
+  // The syscalls of dish itself, not of the commands, while it runs line. They are counted
+  // with ptrace in a forked copy.
+  std::map<long, std::size_t> count_syscalls(const String &line)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+      raise(SIGSTOP);
+      run_command(line);
+      std::_Exit(0);
+    }
+    std::map<long, std::size_t> counts;
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    int sig = 0;
+    while (true)
+    {
+      ptrace(PTRACE_SYSCALL, pid, nullptr, sig);
+      if (waitpid(pid, &status, 0) == -1 || WIFEXITED(status) || WIFSIGNALED(status))
+        break;
+      sig = 0;
+      if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+      {
+        // e.g. SIGCHLD, delivered as it would be
+        sig = WSTOPSIG(status);
+        continue;
+      }
+      __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+        ++counts[static_cast<long>(info.entry.nr)];
+    }
+    return counts;
+  }
+
+  std::size_t total(const std::map<long, std::size_t> &counts)
+  {
+    std::size_t ret = 0;
+    for (auto &r: counts)
+      ret += r.second;
+    return ret;
+  }
+}// namespace
+
+// The syscalls of dish for a pipeline of 50 stages, against a single stage. The stages have
+// their own fd tables, dish does not dup2 its own stdio for them.
+int main(int argc, char **argv)
+{
+  auto stages = bench::get_count(argc, argv, 50);
+  bench::init();
+
+  // not the native true, which runs in dish
+  String pipeline = "/bin/true";
+  for (std::size_t i = 1; i < stages; ++i)
+    pipeline += " | cat";
+  auto one = count_syscalls("/bin/true");
+  auto all = count_syscalls(pipeline);
+
+  fmt::println("{:<12} {:>10} {:>10}", "syscall", "1 stage", fmt::format("{} stages", stages));
+  fmt::println("{:<12} {:>10} {:>10}", "total", total(one), total(all));
+  std::pair<const char *, long> shown[]{
+#ifdef SYS_dup2
+          {"dup2", SYS_dup2},
+#endif
+          {"dup3", SYS_dup3}, {"fcntl", SYS_fcntl}, {"close", SYS_close}, {"pipe2", SYS_pipe2},
+          {"clone", SYS_clone},
+#ifdef SYS_clone3
+          {"clone3", SYS_clone3},
+#endif
+#ifdef SYS_newfstatat
+          {"newfstatat", SYS_newfstatat},
+#endif
+          {"wait4", SYS_wait4}};
+  for (auto [name, nr]: shown)
+    fmt::println("{:<12} {:>10} {:>10}", name, one[nr], all[nr]);
+  fmt::println("{:<12} {:>10.1f}", "per stage", static_cast<double>(total(all) - total(one)) / static_cast<double>(stages - 1));
+  return 0;
+}
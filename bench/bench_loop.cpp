@@ -0,0 +1,38 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+#include "dish/interpreter.hpp"
+#include "dish/parser.hpp"
+
+#include <string>
+
+using namespace dish;
+
+// A for loop compiled once against parsing and compiling its body on every iteration, which
+// is what running the body line by line costs.
+int main(int argc, char **argv)
+{
+  auto n = bench::get_count(argc, argv, 20000);
+  bench::init();
+
+  const String body = "cd . && cd .";
+  bench::report("parse+compile of the body", bench::measure(n, [&body]
+                                                            { interpreter::compile(parser::parse(body)); }));
+  bench::report("re-parse every iteration", bench::measure(n, [&body]
+                                                           { interpreter::execute(*interpreter::compile(parser::parse(body))); }));
+  String loop = fmt::format("for i in {{1..{}}}; do {}; done", n, body);
+  bench::report("compiled for loop, per iteration", bench::measure(1, [&loop] { run_command(loop); }) / static_cast<double>(n));
+  return 0;
+}
@@ -0,0 +1,46 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+#include "dish/utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+using namespace dish;
+
+// Commands per second of true, false, echo, printf, test, [ and cat run natively, and with
+// dish.prefer_external, which launches the executables as before.
+int main(int argc, char **argv)
+{
+  auto n = bench::get_count(argc, argv, 2000);
+  bench::init();
+
+  auto file = utils::get_home()->cpp_str() + "/cat.txt";
+  std::ofstream{file} << "a line for cat\n";
+  String round = fmt::format("true; false; echo hello > /dev/null; printf %s-%d a 1 > /dev/null; "
+                             "test -n abc; [ 1 -lt 2 ]; cat {} > /dev/null",
+                             file);
+  constexpr std::size_t commands = 7;
+
+  dish_context.lua_state["dish"]["prefer_external"] = true;
+  auto external = bench::measure(std::max<std::size_t>(n / 20, 1), [&round] { run_command(round); });
+  bench::report("dish.prefer_external, per command", external / commands);
+
+  dish_context.lua_state["dish"]["prefer_external"] = false;
+  auto native = bench::measure(n, [&round] { run_command(round); });
+  bench::report("native, per command", native / commands);
+  return 0;
+}
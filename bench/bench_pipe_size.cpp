@@ -0,0 +1,37 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+
+#include <string>
+
+using namespace dish;
+
+// The throughput of a synthetic pipeline, head -c N /dev/zero | cat | cat | wc -c, with the
+// pipes dish.pipe_size gives it.
+int main(int argc, char **argv)
+{
+  // MiB through the pipeline
+  auto mb = bench::get_count(argc, argv, 2000);
+  bench::init();
+
+  auto pipeline = fmt::format("head -c {} /dev/zero | cat | cat | wc -c > /dev/null", mb * 1024 * 1024);
+  for (auto size: {"default", "256K", "1M", "adaptive"})
+  {
+    dish_context.lua_state["dish"]["pipe_size"] = size;
+    auto us = bench::measure(1, [&pipeline] { run_command(pipeline); });
+    fmt::println("{:<12} {:>10.3f} s {:>10.0f} MiB/s", size, us / 1e6, static_cast<double>(mb) * 1e6 / us);
+  }
+  return 0;
+}
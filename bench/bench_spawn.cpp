@@ -0,0 +1,41 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "bench.hpp"
+#include "dish/dish.hpp"
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+using namespace dish;
+
+// The latency of launching /bin/true against the RSS of dish. 'on nice=0' makes dish fork, as
+// posix_spawn can not set the nice value; setting it to 0 again costs one syscall.
+int main(int argc, char **argv)
+{
+  auto n = bench::get_count(argc, argv, 200);
+  bench::init();
+
+  std::unique_ptr<char[]> held;
+  for (std::size_t mb: {0, 64, 256, 1024})
+  {
+    // touched, so the pages are mapped and fork has to copy their page tables
+    held.reset();
+    held.reset(new char[mb * 1024 * 1024 + 1]);
+    std::memset(held.get(), 1, mb * 1024 * 1024 + 1);
+    bench::report(fmt::format("RSS +{}MB, fork", mb), bench::measure(n, [] { run_command("on nice=0 /bin/true"); }));
+    bench::report(fmt::format("RSS +{}MB, posix_spawn", mb), bench::measure(n, [] { run_command("/bin/true"); }));
+  }
+  return 0;
+}
@@ -0,0 +1,28 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_ARITHMETIC_HPP
+#define DISH_ARITHMETIC_HPP
+#pragma once
+
+#include <string_view>
+
+namespace dish::arithmetic
+{
+  // Evaluates the integer expression of $(( )) in-process. It has the operators of C (without
+  // casts, sizeof and pointers) plus '**', and reads and assigns variables by name, e.g.
+  // i = i + 1, i++ or n > 0 ? n : -n. Parameters in the expression should be expanded before.
+  // Returns -1 on a syntax error or a division by zero.
+  int evaluate(std::string_view expr, long long &result);
+}// namespace dish::arithmetic
+#endif
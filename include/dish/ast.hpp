@@ -0,0 +1,230 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_AST_HPP
+#define DISH_AST_HPP
+#pragma once
+
+#include "token.hpp"
+
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <utility>
+
+namespace dish::ast
+{
+  // A bump allocator for everything parsed from a line. Nothing allocated from it is ever
+  // destroyed, the memory is released at once with the arena, so nodes must only hold
+  // memory from the same arena.
+  class Arena
+  {
+  private:
+    std::pmr::monotonic_buffer_resource resource;
+
+  public:
+    Arena() : resource(1024) {}
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    std::pmr::memory_resource *get_resource();
+
+    // Nodes are constructed with the arena's memory_resource as the first argument.
+    template<typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+      void *p = resource.allocate(sizeof(T), alignof(T));
+      return new (p) T(&resource, std::forward<Args>(args)...);
+    }
+
+    std::string_view copy(std::string_view str);
+  };
+
+  enum class NodeType
+  {
+    command,
+    pipeline,
+    list,
+    if_clause,
+    for_clause,
+    while_clause,
+    case_item,
+    case_clause,
+    function_def
+  };
+
+  struct Node
+  {
+    NodeType type;
+
+    explicit Node(NodeType type_) : type(type_) {}
+  };
+
+  struct Word
+  {
+    lexer::TokenType type;
+    std::string_view text;
+  };
+
+  // For <<, target is the body of the here-document, which is not expanded if the delimiter
+  // is quoted.
+  struct Redirect
+  {
+    lexer::TokenType type;
+    std::string_view target;
+    bool quoted = false;
+    // the n of n>file, -1 for the default of the operator
+    int fd = -1;
+    // &> and &>>, stderr goes to the same file
+    bool with_stderr = false;
+    // the index of the command in the pipeline it is after
+    std::size_t command = 0;
+  };
+
+  // A simple command, one process of a pipeline.
+  struct Command : public Node
+  {
+    std::pmr::vector<Word> words;
+
+    explicit Command(std::pmr::memory_resource *r) : Node(NodeType::command), words(r) {}
+  };
+
+  struct Pipeline : public Node
+  {
+    std::pmr::vector<const Command *> commands;
+    std::pmr::vector<Redirect> redirects;
+    bool background;
+    bool timed;// time pipeline
+    std::string_view pipe_size;// pipe_size=SIZE pipeline, empty for dish.pipe_size
+    std::pmr::vector<std::string_view> placement;// the key=value options of 'on', placement and limits
+    std::string_view text;// for message
+
+    explicit Pipeline(std::pmr::memory_resource *r)
+        : Node(NodeType::pipeline), commands(r), redirects(r), background(false), timed(false), placement(r) {}
+  };
+
+  enum class Connector
+  {
+    seq,    // ; & or newline
+    and_and,// &&
+    or_or   // ||
+  };
+
+  struct ListItem
+  {
+    // How this item is connected to the previous one, the first item is always seq.
+    Connector connector;
+    const Node *node;
+  };
+
+  struct List : public Node
+  {
+    std::pmr::vector<ListItem> items;
+
+    explicit List(std::pmr::memory_resource *r) : Node(NodeType::list), items(r) {}
+  };
+
+  struct IfBranch
+  {
+    const List *cond;
+    const List *body;
+  };
+
+  // if ...; then ...; elif ...; then ...; else ...; fi
+  struct IfClause : public Node
+  {
+    std::pmr::vector<IfBranch> branches;
+    const List *else_body;
+
+    explicit IfClause(std::pmr::memory_resource *r) : Node(NodeType::if_clause), branches(r), else_body(nullptr) {}
+  };
+
+  // for name in words...; do ...; done
+  struct ForClause : public Node
+  {
+    std::string_view name;
+    std::pmr::vector<Word> words;
+    bool positional;// no 'in', iterates over $@
+    const List *body;
+
+    explicit ForClause(std::pmr::memory_resource *r)
+        : Node(NodeType::for_clause), words(r), positional(false), body(nullptr) {}
+  };
+
+  // while/until ...; do ...; done
+  struct WhileClause : public Node
+  {
+    const List *cond;
+    const List *body;
+    bool until;
+
+    explicit WhileClause(std::pmr::memory_resource *)
+        : Node(NodeType::while_clause), cond(nullptr), body(nullptr), until(false) {}
+  };
+
+  // pattern | pattern) ...;;
+  struct CaseItem : public Node
+  {
+    std::pmr::vector<Word> patterns;
+    const List *body;
+
+    explicit CaseItem(std::pmr::memory_resource *r) : Node(NodeType::case_item), patterns(r), body(nullptr) {}
+  };
+
+  // case word in items... esac
+  struct CaseClause : public Node
+  {
+    Word word;
+    std::pmr::vector<const CaseItem *> items;
+
+    explicit CaseClause(std::pmr::memory_resource *r) : Node(NodeType::case_clause), word{}, items(r) {}
+  };
+
+  // name() { ...; }, the body may also be any other compound command
+  struct FunctionDef : public Node
+  {
+    std::string_view name;
+    const Node *body;
+
+    explicit FunctionDef(std::pmr::memory_resource *) : Node(NodeType::function_def), body(nullptr) {}
+  };
+
+  template<typename T>
+  const T &as(const Node *node)
+  {
+    return *static_cast<const T *>(node);
+  }
+
+  // A parsed line. The source, its tokens and the nodes all live in the arena.
+  class Tree
+  {
+  private:
+    Arena arena;
+    std::string_view source;
+    const Node *root;
+
+  public:
+    Tree() : root(nullptr) {}
+
+    Arena &get_arena();
+
+    std::string_view get_source() const;
+
+    void set_source(std::string_view src);
+
+    const Node *get_root() const;
+
+    void set_root(const Node *node);
+  };
+}// namespace dish::ast
+#endif
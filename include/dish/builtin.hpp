@@ -18,6 +18,8 @@
 #include "type_alias.hpp"
 #include "utils.hpp"
 
+#include <sys/stat.h>
+
 #include <functional>
 #include <map>
 #include <string>
@@ -69,5 +71,35 @@ namespace dish::builtin
           {"type", builtin_type},
           {"source", builtin_source},
   };
+
+  // Native versions of common commands. They run in dish when they are the last command of a
+  // pipeline instead of being launched, unless dish.prefer_external is true or lists them.
+  int native_true(Args);
+
+  int native_false(Args);
+
+  int native_echo(Args);
+
+  int native_printf(Args);
+
+  int native_test(Args);
+
+  int native_cat(Args);
+
+  static const std::map<String, Func> natives{
+          {"true", native_true},
+          {"false", native_false},
+          {"echo", native_echo},
+          {"printf", native_printf},
+          {"test", native_test},
+          {"[", native_test},
+          {"cat", native_cat},
+  };
+
+  // Whether the native version can run args the same as the command, e.g. cat only handles
+  // regular files without options. out is the stdout it would have, nullptr if unknown.
+  bool native_supports(Args args, const struct stat *out);
+
+  bool prefer_external(const String &name);
 }// namespace dish::builtin
 #endif
\ No newline at end of file
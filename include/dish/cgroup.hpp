@@ -0,0 +1,81 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_CGROUP_HPP
+#define DISH_CGROUP_HPP
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Resource limits of a job. With a writable cgroup v2 subtree, i.e. one delegated to the user,
+// each limited job gets a leaf cgroup under the one of dish. Otherwise memory is set as an rlimit
+// by the children instead, and cpu and pids are not supported.
+namespace dish::cgroup
+{
+  // memory.max, cpu.max and pids.max, 0 is not limited
+  struct Limits
+  {
+    long long memory = 0;// bytes
+    long long cpu_quota = 0;// microseconds in each cpu_period
+    long long pids = 0;
+    static constexpr long long cpu_period = 100000;
+
+    bool empty() const;
+  };
+
+  bool is_limit_option(std::string_view key);
+
+  // Sets an option of 'on', e.g. "memory", "2G". Returns -1 if the value is invalid.
+  int set_limit_option(Limits &limits, std::string_view key, std::string_view value);
+
+  // What the leaf of a job has accounted.
+  struct Usage
+  {
+    long long memory_peak = -1;// bytes, -1 if the kernel has no memory.peak
+    double cpu = 0;// seconds
+    double throttled = 0;
+    long long oom_kills = 0;
+  };
+
+  class Leaf
+  {
+  private:
+    std::string path;
+    // cgroup.procs of the leaf, a child joins by writing 0
+    int procs_fd;
+
+  public:
+    Leaf() : procs_fd(-1) {}
+
+    // Returns -1 if there is no writable cgroup v2 subtree or a limit can not be set.
+    int create(const Limits &limits);
+
+    bool is_created() const;
+
+    // Moves the calling process, a forked child, into the leaf. Returns -1 on error.
+    int enter() const;
+
+    Usage read() const;
+
+    // The processes have all exited. A leaf still used by a process that escaped the job,
+    // e.g. a daemon, is left.
+    void remove();
+  };
+
+  // The fallback in a child: memory is RLIMIT_AS, which limits the virtual address space rather
+  // than the resident memory that memory.max accounts. RLIMIT_NPROC counts all the processes of
+  // the user, not of the job, so pids has no fallback, nor does cpu.
+  void apply_rlimits(const Limits &limits);
+}// namespace dish::cgroup
+#endif
@@ -21,36 +21,29 @@
 
 #include <termios.h>
 
-#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
 
 namespace dish
 {
-  namespace job
-  {
-    class Job;
-  }
-
   struct DishContext
   {
     bool running;
     sol::state lua_state;
-
-    std::list<std::shared_ptr<job::Job>> jobs;
+    // after lua_state, so the functions are released before the state is closed
+    lua::FunctionTable lua_functions;
 
     pid_t pgid;
     struct termios tmodes;
     int terminal;
     int is_interactive;
-
-    std::atomic<bool> waiting;
   };
 
   extern DishContext dish_context;
 
-  void dish_init();
+  // Job control and the terminal are only set up if interactive and stdin is a terminal.
+  void dish_init(bool interactive);
 
   void run_command(const String &cmd);
 
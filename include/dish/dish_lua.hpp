@@ -17,8 +17,37 @@
 
 #include "bundled/sol/sol.hpp"
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace dish::lua
 {
+  // The functions of dish.func, which is a proxy of it like dish.alias. They are kept as
+  // protected functions, so running one is a lookup and a call instead of compiling a chunk.
+  // A value may also be {f, argv = true}, then f gets one table of the arguments.
+  class FunctionTable
+  {
+  public:
+    struct Function
+    {
+      sol::protected_function function;
+      bool argv;
+    };
+
+  private:
+    std::unordered_map<std::string, Function> functions;
+
+  public:
+    void set(const std::string &name, sol::object value);
+
+    void clear();
+
+    const Function *find(const std::string &name) const;
+
+    std::vector<std::string> list() const;
+  };
+
   sol::protected_function_result dish_sol_error_handler(lua_State *L, sol::protected_function_result pfr);
   int dish_sol_exception_handler(lua_State *L, sol::optional<const std::exception &> maybe_exception, sol::string_view description);
 }// namespace dish::lua
@@ -0,0 +1,43 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_EVENT_LOOP_HPP
+#define DISH_EVENT_LOOP_HPP
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+// What dish waits for while the line editor is idle: the terminal, children changing state,
+// window size changes and timers, all in one epoll. Signals are read from a signalfd, so no
+// work is done in a signal handler.
+namespace dish::event_loop
+{
+  enum Event : unsigned
+  {
+    input = 1,   // the fd passed to wait() is readable
+    children = 2,// some children have been reaped, see job::reap_children
+    resize = 4,  // SIGWINCH
+    timer = 8    // some timers are due, see run_timers
+  };
+
+  // Returns the events that happened, at least one. SIGCHLD and SIGWINCH are only blocked,
+  // and so read from the signalfd, while waiting, as commands and Lua inherit the mask of dish.
+  unsigned wait(int fd);
+
+  // func is run by run_timers once delay has passed.
+  void add_timer(std::chrono::milliseconds delay, std::function<void()> func);
+
+  void run_timers();
+}// namespace dish::event_loop
+#endif
@@ -0,0 +1,37 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_EXPANSION_HPP
+#define DISH_EXPANSION_HPP
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace dish::expansion
+{
+  // Expands $NAME, ${NAME}, ${NAME:-word}, ${NAME-word}, ${NAME:=word}, ${NAME:+word}, ${#NAME},
+  // $?, $$, $#, $@, $*, $0-$9, $((expr)) and $(command) anywhere in word and removes its quotes,
+  // in one pass.
+  // The result is appended to out, so one buffer can be reused for all words.
+  // glob is set if an unquoted '*' or '?', or a leading '~' is left for utils::expand.
+  // Returns -1 on a bad substitution.
+  int expand(std::string_view word, std::string &out, bool *glob = nullptr);
+
+  // The body of a here-document only has its $... expanded, quotes are kept.
+  int expand_heredoc(std::string_view body, std::string &out);
+
+  // NAME=value, which sets NAME when the words of a command are all such words
+  bool is_assignment(std::string_view word);
+}// namespace dish::expansion
+#endif
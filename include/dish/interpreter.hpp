@@ -0,0 +1,129 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_INTERPRETER_HPP
+#define DISH_INTERPRETER_HPP
+#pragma once
+
+#include "ast.hpp"
+#include "job.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dish::interpreter
+{
+  // 'status' is the exit status of the last command.
+  enum class OpCode : std::uint8_t
+  {
+    run,          // run the pipeline node
+    assign,       // set the variables of the NAME=value words of the command node
+    jump,         // goto target
+    jump_if_true, // goto target if status is 0
+    jump_if_false,// goto target if status is not 0
+    set_status,   // status = target
+    loop_enter,   // push a loop status of 0
+    loop_store,   // loop status = status
+    loop_exit,    // status = loop status, pop
+    for_begin,    // expand the words of the for node and push them
+    for_next,     // assign the next word to the variable, or goto target if there is none
+    for_end,      // pop the words
+    case_begin,   // expand the word of the case node and push it, status = 0
+    case_match,   // goto target unless the word matches a pattern of the case_item node
+    case_end,     // pop the word
+    define,       // compile the body of the function_def node and store it, status = 0
+    ret           // return from the function
+  };
+
+  struct Instruction
+  {
+    OpCode op;
+    std::uint32_t target;
+    const ast::Node *node;
+  };
+
+  // A line lowered to instructions, so the body of a loop is neither parsed nor walked again
+  // on each iteration. The instructions point into the tree.
+  struct Program
+  {
+    std::shared_ptr<const ast::Tree> tree;
+    std::vector<Instruction> code;
+  };
+
+  class Compiler
+  {
+  private:
+    struct Loop
+    {
+      std::uint32_t continue_target;
+      std::vector<std::size_t> breaks;
+      std::size_t case_depth;
+    };
+
+    std::vector<Instruction> &code;
+    std::vector<Loop> loops;
+    std::size_t case_depth;
+    bool in_function;
+
+  public:
+    Compiler(std::vector<Instruction> &code_, bool in_function_ = false)
+        : code(code_), case_depth(0), in_function(in_function_) {}
+
+    void compile(const ast::Node *node);
+
+  private:
+    std::size_t emit(OpCode op, const ast::Node *node = nullptr, std::uint32_t target = 0);
+
+    // Points the jump at pos to the next instruction.
+    void patch(std::size_t pos);
+
+    std::uint32_t here() const;
+
+    void compile_list(const ast::List &list);
+
+    void compile_pipeline(const ast::Pipeline &pipeline);
+
+    void compile_if(const ast::IfClause &node);
+
+    void compile_for(const ast::ForClause &node);
+
+    void compile_while(const ast::WhileClause &node);
+
+    void compile_case(const ast::CaseClause &node);
+  };
+
+  std::shared_ptr<const Program> compile(std::shared_ptr<const ast::Tree> tree);
+
+  // Function bodies share the tree of the line defining them.
+  extern std::unordered_map<std::string, std::shared_ptr<const Program>> functions;
+
+  // Calls a function with args[0] as its name. The arguments are bound to $1, $2... by
+  // reference, so args must outlive the call.
+  int call_function(const Program &function, const std::vector<String> &args);
+
+  // Globs, '~' and variables are expanded here, right before launching, so the AST can be
+  // reused. Returns -1 on a bad substitution.
+  int instantiate(const ast::Pipeline &pipeline, job::Job &job);
+
+  // Runs the program and returns its exit status.
+  int execute(const Program &program);
+
+  // $(line): runs line with its stdout captured and appends the output without trailing
+  // newlines to out. Builtins, functions and Lua functions run in dish itself. Returns -1 on a
+  // syntax error.
+  int substitute_command(std::string_view line, std::string &out);
+}// namespace dish::interpreter
+#endif
@@ -16,19 +16,29 @@
 #pragma once
 
 #include "builtin.hpp"
+#include "cgroup.hpp"
 #include "dish.hpp"
 #include "utils.hpp"
 
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <list>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+namespace dish::interpreter
+{
+  struct Program;
+}
+
 namespace dish::job
 {
   enum class RedirectType
@@ -36,47 +46,87 @@ namespace dish::job
     overwrite,
     append,
     input,
-    fd
+    read_write,
+    fd,
+    close,
+    here// the String is the content of << or <<<
   };
 
+  // One entry of the fd table of a process, e.g. 2>&1 makes fd 2 a copy of fd 1. The entries
+  // are applied in order by the child, or by dish for a command run in dish.
   class Redirect
   {
   private:
     RedirectType type;
+    int target;
     std::variant<int, String> redirect;
 
   public:
     Redirect() = default;
     template<typename T, typename = std::enable_if_t<!std::is_base_of_v<Redirect, std::decay_t<T>>>>
-    Redirect(RedirectType type_, T &&redirect_) : type(type_), redirect(redirect_)
+    Redirect(RedirectType type_, int target_, T &&redirect_) : type(type_), target(target_), redirect(redirect_)
     {}
 
+    RedirectType get_type() const;
+
+    // the fd that is redirected
+    int get_target() const;
+
     bool is_description() const;
 
-    String get_filename() const;
+    const String &get_filename() const;
 
     int get_description() const;
 
+    // the flags of open(2) for a file, without O_CLOEXEC
+    int get_flags() const;
+
+    // Opens the file or the here-document as a close-on-exec fd.
     int get() const;
   };
 
+  // What wait4 reports of a process, and the wall time from its launch to its reap.
+  struct ProcessStats
+  {
+    double real = 0;// seconds
+    double user = 0;
+    double sys = 0;
+    long max_rss = 0;// KiB
+    long minor_faults = 0;
+    long major_faults = 0;
+    long voluntary_switches = 0;
+    long involuntary_switches = 0;
+
+    // Adds the times and counts, max_rss is the max.
+    void add(const ProcessStats &other);
+  };
+
   class Job;
   enum class ProcessType
   {
     unknown,
+    function,
     builtin,
+    native,
     lua_func,
-    executable
+    executable,
+    substitution// the command of <(...) or >(...), run by a forked dish
   };
 
   class Process
   {
     friend class Job;
+    friend class JobTable;
 
   private:
     Job *job_context;
     std::vector<String> args;
+    std::vector<Redirect> redirects;
     String cmd_path;
+    // substitution only, its end of the pipe becomes target_fd
+    std::shared_ptr<const interpreter::Program> program;
+    int pipe_fd;
+    int target_fd;
 
   public:
     ProcessType type;
@@ -85,16 +135,22 @@ namespace dish::job
     int exit_status;
     bool completed;
     bool stopped;
+    ProcessStats stats;
+    std::chrono::steady_clock::time_point launch_time;
 
   public:
     Process()
-        : pid(-1), status(-1), completed(false),
-          stopped(false), exit_status(-1), type(ProcessType::unknown), job_context(nullptr) {}
+        : job_context(nullptr), pipe_fd(-1), target_fd(-1), type(ProcessType::unknown),
+          pid(-1), status(-1), exit_status(-1), completed(false), stopped(false) {}
 
-    void launch();
+    // fdin and fdout become the stdin and stdout of the process and are closed, -1 keeps the
+    // one of dish. They are -1 for a substitution, which has its own pipe.
+    void launch(int fdin, int fdout);
 
     void insert(String str);
 
+    void insert_redirect(Redirect redirect);
+
     void clear();
 
     bool empty() const;
@@ -104,24 +160,90 @@ namespace dish::job
     int find_cmd();
 
     std::vector<char *> get_args() const;
+
+    // the args joined by spaces, for messages
+    String get_command() const;
+
+  private:
+    // builtins, functions and Lua, sets exit_status
+    void run_in_dish();
+
+    // Returns the pid, 0 if posix_spawn failed, or -1 if the process has to be forked.
+    int spawn(int fdin, int fdout, const std::vector<int> &here_fds, char *const *envp);
+
+    // Makes fdin, fdout and the redirects the fds of the calling process. here_fds are the
+    // opened here-documents of redirects. If saved is not nullptr, the fds replaced are saved
+    // in it for restore_fds. Returns -1 if a file can not be opened.
+    int apply_fds(int fdin, int fdout, const std::vector<int> &here_fds,
+                  std::vector<std::pair<int, int>> *saved) const;
+
+    // process group, signals and placement of a forked child
+    void enter_job() const;
+
+    // The stdout the process would have as the last stage, from its redirects or the stdout of
+    // dish. Returns -1 if it is unknown.
+    int stat_stdout(struct stat &st) const;
+
+    void mark_status(int status, const struct rusage &usage);
+  };
+
+  // Where the processes of a job run, set by 'on' and dish.placement. It is applied by each
+  // child before exec, the fields not set keep the ones of dish.
+  struct Placement
+  {
+    std::vector<int> cpus;
+    bool spread = false;// each stage of the pipeline gets one of cpus
+    bool has_nice = false;
+    int nice = 0;
+    int io_class = 0;// IOPRIO_CLASS_*, 0 keeps the one of dish
+    int io_level = 0;
+
+    bool empty() const;
   };
 
+  // Sets an option of 'on', e.g. "cpus", "0,2,4-7". Returns -1 if the value is invalid.
+  int set_placement_option(Placement &placement, std::string_view key, std::string_view value);
+
+  // Job::pipe_size, a positive size is in bytes
+  constexpr int default_pipe_size = 0;
+  constexpr int adaptive_pipe_size = -1;
+
   class Job
   {
     friend class Process;
 
   private:
+    // A pipe of an adaptive job, sampled through the stdin of its reader while dish waits.
+    struct PipeState
+    {
+      std::size_t reader;// index in processes
+      int size;
+      int full_samples;
+    };
     String command_str;//for message
-    Redirect out;
-    Redirect in;
-    Redirect err;
     struct termios job_tmodes;
     pid_t cmd_pgid;
     bool background;
+    // Both ends of the pipes of process substitutions, which are closed by dish once the
+    // processes are launched. The substitutions are the first processes.
+    std::vector<int> substitution_fds;
+    std::size_t substitution_count;
+    int pipe_size;
+    std::vector<PipeState> pipes;
+    Placement placement;
+    cgroup::Limits limits;
+    // set by 'on', whose options are reported when they can not apply, unlike the defaults
+    bool explicit_options;
+    cgroup::Leaf leaf;
+    // read from the leaf when the job completes
+    cgroup::Usage usage;
+    bool has_usage;
 
   public:
     std::vector<Process> processes;
     bool notified;
+    // set by JobTable::insert, 0 if the job is not in the table
+    int id;
 
   public:
     Job() = default;
@@ -131,16 +253,24 @@ namespace dish::job
 
     void insert(const Process &scmd);
 
-    void set_in(Redirect redirect);
+    // Returns the path passed to the command, e.g. /dev/fd/63, or an empty String on failure.
+    // 'input' is true for <(...), whose output is read by the command.
+    String insert_substitution(std::shared_ptr<const interpreter::Program> program, bool input);
 
-    void set_out(Redirect redirect);
-
-    void set_err(Redirect redirect);
+    void close_substitution_fds();
 
     void set_background();
 
     void set_foreground();
 
+    void set_pipe_size(int size);
+
+    void set_placement(Placement placement_);
+
+    void set_limits(cgroup::Limits limits_);
+
+    void set_explicit_options();
+
     void put_in_foreground(int cont);
 
     void put_in_background(int cont);
@@ -151,18 +281,102 @@ namespace dish::job
 
     bool is_completed();
 
-    bool is_builtin_or_lua();
+    // The status of the last process, or of the process that failed to launch.
+    int get_exit_status() const;
 
     void wait();
 
-
+    // With the usage of the leaf if the job has one, e.g. for jobs.
     String format_job_info(const String &status);
 
+    // The usage of the leaf, read while the job runs. Returns false if the job has no leaf.
+    bool get_usage(cgroup::Usage &ret) const;
+
     void continue_job();
-    void update_status();
+
+    // The total of the processes. real is from the first launch to the last reap.
+    ProcessStats get_stats() const;
+
+    // Prints the stats of each process and the total to stderr, for 'time'.
+    void print_stats() const;
 
   private:
-    int mark_status(int, int);
+    // Grows the pipes that were nearly full in consecutive samples.
+    void sample_pipes();
+
+    // Reads the usage of the leaf and removes it, once the job has completed.
+    void release_leaf();
   };
+
+  // The jobs by their ids, which stay the same while the job exists, and the launched processes
+  // by their pids, so a reaped child is marked without searching the jobs.
+  class JobTable
+  {
+  private:
+    struct Slot
+    {
+      std::shared_ptr<Job> job;
+      bool changed;
+    };
+    // slots[id - 1], trailing empty slots are removed so a new job gets the highest id + 1
+    std::vector<Slot> slots;
+    std::unordered_map<pid_t, Process *> processes;
+    std::vector<int> changed;
+    std::size_t count;
+
+  public:
+    JobTable() : count(0) {}
+
+    // Returns the id of the job.
+    int insert(std::shared_ptr<Job> job);
+
+    void erase(int id);
+
+    // Returns nullptr if there is no such job.
+    std::shared_ptr<Job> find(int id) const;
+
+    // The latest job that is stopped or in background, nullptr if there is none.
+    std::shared_ptr<Job> current() const;
+
+    std::vector<std::shared_ptr<Job>> list() const;
+
+    std::size_t size() const;
+
+    void add_process(Process *process);
+
+    // Returns -1 if pid is not a process of a job.
+    int mark_status(pid_t pid, int status, const struct rusage &usage);
+
+    void mark_changed(int id);
+
+    // The ids of the jobs changed since the last call, see do_job_notification.
+    std::vector<int> take_changed();
+  };
+
+  extern JobTable job_table;
+
+  // the last foreground job that completed, for dish.last_job_stats
+  extern std::shared_ptr<const Job> last_job;
+
+  // The stdout of the jobs launched while a command substitution runs, -1 for the stdout of
+  // dish. It is the first entry of the fd table of the last stage, so the redirects of the
+  // command still apply. A command run in dish has it as its fd 1 already, so it is -1 then.
+  extern int stdout_capture;
+
+  // Parses "default", "adaptive" or a size like 1048576, 512K or 1M. Returns -2 if text is invalid.
+  int parse_pipe_size(std::string_view text);
+
+  // /proc/sys/fs/pipe-max-size, the limit of F_SETPIPE_SZ for an unprivileged process
+  int max_pipe_size();
+
+  // Writes all of data, retrying on EINTR. Returns -1 on error.
+  int write_all(int fd, std::string_view data);
+
+  // Marks the status in the job pid belongs to. Returns -1 if there is none.
+  int mark_process_status(pid_t pid, int status, const struct rusage &usage);
+
+  // Reaps the children that have changed state without blocking, and returns whether there
+  // were any. The jobs are checked by do_job_notification.
+  bool reap_children();
 }// namespace dish::job
 #endif
\ No newline at end of file
@@ -18,8 +18,10 @@
 #include "job.hpp"
 #include "token.hpp"
 
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dish::lexer
@@ -31,28 +33,57 @@ namespace dish::lexer
     io_modifier_file_name,
     io_modifier_file_desc,
     pipe,
+    and_or,
+    lparen,
     file,
-    background,
+    separator,
     end
   };
 
+  // Returns the position of the first byte in text[pos, end) that may end or change a word,
+  // that is one of ' ', '|', '&', ';', '(', ')', '<', '>', '$', '"', '\n', or text.size() if
+  // there is none.
+  std::size_t find_special(std::string_view text, std::size_t pos);
+
+  // The Lexer works on the raw bytes of the command. The tokens it emits are spans of the
+  // source, so the source must outlive them.
   class Lexer
   {
   private:
-    String text;
+    std::string_view text;
     std::size_t pos;
     CmdState cmd_state;
+    // The delimiters of the <<s whose body has not been lexed yet. The bodies are lexed as
+    // heredoc tokens at the next newline.
+    std::vector<std::string_view> heredoc_delimiters;
+    bool expect_delimiter;
+    bool at_heredoc_body;
 
   public:
-    Lexer(String cmd) : text(cmd), pos(0) {}
+    Lexer(std::string_view cmd)
+        : text(cmd), pos(0), cmd_state(CmdState::init), expect_delimiter(false), at_heredoc_body(false) {}
+    Lexer(const String &cmd) : Lexer(utils::to_view(cmd)) {}
+    Lexer(String &&) = delete;
 
-    std::optional<std::vector<Token>> get_all_tokens();
+    std::optional<std::pmr::vector<Token>>
+    get_all_tokens(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
-    std::vector<Token> get_all_tokens_no_check();
+    std::pmr::vector<Token> get_all_tokens_no_check(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // Continues lexing from the byte offset pos_, which must be the beginning of a token
+    // or a space before it. Used by the line editor to re-lex only the edited region.
+    void seek(std::size_t pos_);
 
-  private:
     Token get_token();
 
+    // true if a << is waiting for its body or the line ending it, which needs more lines
+    bool has_open_heredoc() const;
+
+  private:
+    Token lex_token();
+
+    Token lex_heredoc_body();
+
     int check_cmd(const Token &token);
 
     String mark_error_from_token(const Token &token) const;
@@ -15,31 +15,192 @@
 #define DISH_PARSER_HPP
 #pragma once
 
+#include "ast.hpp"
+#include "interpreter.hpp"
 #include "job.hpp"
 #include "lexer.hpp"
 
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace dish::parser
 {
+  // An alias is lexed once when it is defined. Its tokens are spans of source, so an Alias
+  // can not be copied or moved.
+  struct Alias
+  {
+    std::string source;
+    std::pmr::vector<lexer::Token> tokens;
+
+    Alias() = default;
+    Alias(const Alias &) = delete;
+    Alias &operator=(const Alias &) = delete;
+  };
+
+  class AliasTable
+  {
+  private:
+    std::unordered_map<std::string, Alias> aliases;
+    // bumped by every change, see ParseCache
+    std::size_t generation;
+
+  public:
+    AliasTable() : generation(0) {}
+
+    int set(const std::string &name, std::string_view value);
+
+    void erase(const std::string &name);
+
+    void clear();
+
+    const Alias *find(const std::string &name) const;
+
+    std::size_t get_generation() const;
+
+    std::vector<std::pair<std::string, std::string>> list() const;
+  };
+
+  extern AliasTable alias_table;
+
+  // A recursive descent parser building the AST of a line in the arena:
+  //   list     := and_or ((';' | '&' | newline) and_or)*
+  //   and_or   := (pipeline | compound) (('&&' | '||') (pipeline | compound))*
+  //   pipeline := command redirect* ('|' command redirect*)*
+  //   compound := if | for | while | until | case | '{' list '}'
+  //   function := name '(' ')' compound
+  // Reserved words are only recognized as the first word of a command.
   class Parser
   {
   private:
-    job::Job command;
-    job::Process scmd;
-    std::vector<lexer::Token> tokens;
-    std::size_t pos;
+    // Aliases are spliced by pushing their tokens on top of the line's tokens instead of
+    // inserting them into the vector.
+    struct TokenFrame
+    {
+      const lexer::Token *curr;
+      const lexer::Token *end;
+      std::string_view alias;// empty for the line's own frame
+    };
+    static constexpr std::size_t max_alias_depth = 32;
+
+    ast::Arena &arena;
+    std::string_view source;
+    std::vector<TokenFrame> frames;
+    // the << redirects waiting for their heredoc token, which comes after the newline
+    std::vector<std::pair<ast::Pipeline *, std::size_t>> heredocs;
+
+  public:
+    Parser(ast::Arena &arena_, std::string_view source_, const std::pmr::vector<lexer::Token> &tokens);
+
+    // Returns nullptr if there is a syntax error.
+    const ast::Node *parse();
+
+  private:
+    // Stops before a reserved word in terminators, e.g. 'then' for the condition of 'if'.
+    ast::List *parse_list(std::initializer_list<std::string_view> terminators = {});
+
+    ast::Node *parse_pipeline();
+
+    ast::Command *parse_command();
+
+    int parse_redirects(ast::Pipeline &pipeline);
+
+    ast::IfClause *parse_if();
+
+    ast::ForClause *parse_for();
+
+    ast::WhileClause *parse_while();
+
+    ast::CaseClause *parse_case();
+
+    ast::List *parse_group();
+
+    ast::Node *parse_compound();
+
+    ast::FunctionDef *parse_function();
+
+    ast::Word make_word(const lexer::Token &token);
+
+    int expect(std::string_view keyword);
+
+    void skip_newlines();
+
+    // Heredoc tokens are not seen by the grammar, peek() gives them to the waiting redirects.
+    const lexer::Token *peek();
+
+    // the token after peek(), only looks into the same frame
+    const lexer::Token *peek_next();
+
+    void advance();
+
+    // byte offset in source of the next token of the line itself
+    std::size_t line_pos() const;
+
+    int expand_alias();
+  };
+
+  // Returns nullptr if the line has a syntax error.
+  std::shared_ptr<const ast::Tree> parse(const String &line);
+
+  // Tells whether a source that grows line by line can be parsed without the lines after it,
+  // i.e. no compound command, quote, here-document or '&&'/'||' is left open. Used to run a
+  // script command by command. Lexing resumes at the last newline outside of a token or
+  // here-document, so only a quote or here-document still open is lexed again.
+  class CompletenessChecker
+  {
+  private:
+    // where lexing resumes, and the state there
+    std::size_t checkpoint;
+    std::size_t depth;
+    bool connector;
 
   public:
-    Parser(const String &cmd, std::vector<lexer::Token> tokens_);
+    CompletenessChecker() : checkpoint(0), depth(0), connector(false) {}
 
-    int parse();
+    // source begins with the source of the last call, if any since reset()
+    bool is_complete(std::string_view source);
 
-    job::Job get_cmd() const;
+    // for the source of the next command
+    void reset();
+  };
 
+  // LRU cache of compiled command lines. An entry is only valid for the alias generation it was
+  // parsed with, since aliases are substituted while parsing.
+  class ParseCache
+  {
   private:
-    int parse_cmd(job::Job &);
+    struct Entry
+    {
+      String line;
+      std::size_t generation;
+      std::shared_ptr<const interpreter::Program> program;
+    };
+    std::list<Entry> entries;
+    std::unordered_map<String, std::list<Entry>::iterator> index;
+    std::size_t capacity;
+    std::size_t hits;
+    std::size_t misses;
+
+  public:
+    ParseCache(std::size_t capacity_) : capacity(capacity_), hits(0), misses(0) {}
+
+    // Returns nullptr if the line has a syntax error.
+    std::shared_ptr<const interpreter::Program> get(const String &line);
+
+    void clear();
+
+    std::size_t get_hits() const;
+
+    std::size_t get_misses() const;
+
+    std::size_t size() const;
   };
+
+  extern ParseCache parse_cache;
 }// namespace dish::parser
-#endif
\ No newline at end of file
+#endif
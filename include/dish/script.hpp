@@ -0,0 +1,41 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_SCRIPT_HPP
+#define DISH_SCRIPT_HPP
+#pragma once
+
+#include "parser.hpp"
+
+#include <cstddef>
+#include <string_view>
+
+// Running commands without the line editor, for dish -c, scripts and commands piped to dish.
+// Each command is run once it is complete, as a stream may never end.
+namespace dish::script
+{
+  // Runs the complete commands at the beginning of text and returns the number of bytes they
+  // take. If eof is true, the rest is run too. The checker keeps what it has seen of the rest,
+  // the text of the next call begins with it.
+  std::size_t run_commands(std::string_view text, bool eof, parser::CompletenessChecker &checker);
+
+  // The following return the status of the last command.
+  int run_string(std::string_view source);
+
+  // The file is mapped instead of read.
+  int run_file(const char *path);
+
+  // A regular file is mapped, a pipe or terminal is read in large blocks.
+  int run_stream(int fd);
+}// namespace dish::script
+#endif
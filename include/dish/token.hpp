@@ -19,6 +19,7 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dish::lexer
@@ -38,37 +39,41 @@ namespace dish::lexer
     rt_and,
     lt_rt,
     background,
+    semicolon,
+    dsemi,
+    and_and,
+    or_or,
+    lparen,
+    rparen,
     env_var,
+    heredoc,// the body of a <<, after the newline ending its line
     end
   };
 
+  // A Token does not own its content, it is a span of the source it was lexed from.
+  // The source must outlive the token.
   class Token
   {
   private:
     TokenType type;
-    String content;
-    String error;
-    std::size_t pos;
-    std::size_t size;
+    std::string_view content;
+    std::size_t pos;// byte offset in the source
+    const char *error;
 
   public:
     Token() = default;
-    Token(TokenType type_, String content_, std::size_t pos_, std::size_t size_,
-          String error_ = "")
-        : type(type_), content(std::move(content_)), pos(pos_), size(size_), error(error_) {}
+    Token(TokenType type_, std::string_view content_, std::size_t pos_, const char *error_ = nullptr)
+        : type(type_), content(content_), pos(pos_), error(error_) {}
 
     TokenType get_type() const;
 
-    String get_content() const;
+    std::string_view get_content() const;
 
-    String get_error() const;
+    const char *get_error() const;
 
     std::size_t get_pos() const;
 
     std::size_t get_size() const;
-
-    void set_content(String c);
-    void set_error(String c);
   };
 }// namespace dish::lexer
-#endif
\ No newline at end of file
+#endif
@@ -20,6 +20,7 @@
 #include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #define FMT_HEADER_ONLY
@@ -71,7 +72,9 @@ namespace dish::utils
   enum class CommandType
   {
     not_found,
+    function,
     builtin,
+    native,
     lua_func,
     executable_file,
     executable_link,
@@ -106,7 +109,52 @@ namespace dish::utils
 
   std::optional<std::vector<String>> expand_wildcards(const String &s);
 
-  std::vector<String> expand(const String &str);
+  // ~ and wildcards, the words are appended to out.
+  void expand(const String &str, std::vector<String> &out);
+
+  // The ')' matching the '(' at pos, npos if there is none. Parentheses in "..." are not
+  // counted, e.g. in $(echo ")").
+  std::size_t find_matching_paren(std::string_view text, std::size_t pos);
+
+  // true if word has a {a,b} or {x..y} to expand
+  bool has_braces(std::string_view word);
+
+  // Brace expansion of a word: a{b,c}d is abd acd, {1..3} is 1 2 3, and {a..e}, {01..10} and
+  // {1..10..2} work too. The words are generated one by one by next(), so {1..1000000} is never
+  // materialized. Quotes, ${...} and $(...) are left for expansion::expand.
+  class BraceExpansion
+  {
+  private:
+    // The first brace of word, which is replaced by each of its items in turn. A word made
+    // this way that still has braces is expanded by the next frame.
+    struct Frame
+    {
+      std::string word;
+      std::size_t open;
+      std::size_t close;
+      // {a,b}, the beginning of the next item
+      std::size_t item;
+      // {x..y..step}
+      bool is_range;
+      bool is_char;
+      long long curr;
+      // the items left, counted so that curr never steps past the limits of long long
+      unsigned long long left;
+      long long step;
+      int width;
+    };
+    std::vector<Frame> frames;
+
+  public:
+    explicit BraceExpansion(std::string_view word);
+
+    // Returns false after the last word.
+    bool next(std::string &out);
+
+  private:
+    // pushes a frame for the first brace of word, returns false if there is none
+    bool push(std::string &&word);
+  };
 
   template<typename STR_VIEW, typename T>
   T split(STR_VIEW str, STR_VIEW delims = " ")
@@ -125,23 +173,21 @@ namespace dish::utils
     return ret;
   }
 
-  template<typename T>
-  auto &&list_at(const std::list<T> &list, size_t index)
-  {
-    auto it = list.begin();
-    std::advance(it, index);
-    return *it;
-  }
-
   String get_timestamp();
 
   String to_string(CommandType ct);
 
+  String to_string(std::string_view view);
+
+  std::string_view to_view(const String &str);
+
   bool operator<(const Command &a, const Command &b);
 
   bool is_executable(const std::filesystem::path &path);
 
-  std::tuple<CommandType, String> find_command(const String &cmd);
+  // With native false, a native command is only used if there is no executable, e.g. for a
+  // command that is not the last of a pipeline.
+  std::tuple<CommandType, String> find_command(const String &cmd, bool native = true);
 
   String tilde(const String &path);
 
@@ -0,0 +1,84 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#ifndef DISH_VARIABLE_HPP
+#define DISH_VARIABLE_HPP
+#pragma once
+
+#include "type_alias.hpp"
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dish::variable
+{
+  // The variables of dish. The exported ones, set by export, dish.environment in Lua, or
+  // inherited by dish, are the environment of the commands it launches. dish.environment is a
+  // proxy of it.
+  class VariableTable
+  {
+  private:
+    // std::less<> allows looking up a string_view without building a std::string
+    std::map<std::string, std::string, std::less<>> variables;
+    std::set<std::string, std::less<>> exported;
+    // the arguments of the functions being called, see interpreter::call_function
+    std::vector<const std::vector<String> *> args_stack;
+    int last_status;
+
+    // "NAME=value" for execve, rebuilt after an exported variable changes
+    std::vector<std::string> envp_storage;
+    std::vector<char *> envp;
+    bool envp_dirty;
+
+  public:
+    VariableTable() : last_status(0), envp_dirty(true) {}
+
+    const std::string *get(std::string_view name) const;
+
+    void set(std::string_view name, std::string_view value);
+
+    // Puts name in the environment, it is set to "" if it is not set.
+    void export_variable(std::string_view name);
+
+    bool is_exported(std::string_view name) const;
+
+    void erase(std::string_view name);
+
+    void clear();
+
+    const std::map<std::string, std::string, std::less<>> &list() const;
+
+    char *const *get_envp();
+
+    void push_args(const std::vector<String> *args);
+
+    void pop_args();
+
+    // nullptr outside of a function
+    const std::vector<String> *get_args() const;
+
+    std::size_t get_call_depth() const;
+
+    // $?
+    int get_last_status() const;
+
+    void set_last_status(int status);
+  };
+
+  extern VariableTable variable_table;
+}// namespace dish::variable
+#endif
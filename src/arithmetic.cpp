@@ -0,0 +1,479 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/arithmetic.hpp"
+#include "dish/utils.hpp"
+#include "dish/variable.hpp"
+
+#include <charconv>
+#include <climits>
+#include <string_view>
+
+namespace dish::arithmetic
+{
+  // A precedence climbing parser evaluating while it parses, there is no tree.
+  class Evaluator
+  {
+  private:
+    std::string_view expr;
+    std::size_t pos;
+    // set on the side of &&, || and ?: that is not taken, which must not assign or fail
+    bool skip;
+    const char *error;
+
+  public:
+    Evaluator(std::string_view expr_) : expr(expr_), pos(0), skip(false), error(nullptr) {}
+
+    int evaluate(long long &result);
+
+  private:
+    long long parse_comma();
+
+    long long parse_assign();
+
+    long long parse_ternary();
+
+    long long parse_binary(int min_prec);
+
+    long long parse_unary();
+
+    long long parse_primary();
+
+    std::string_view parse_name();
+
+    long long get_variable(std::string_view name);
+
+    void set_variable(std::string_view name, long long value);
+
+    // ignoring spaces
+    char peek();
+
+    bool at(std::string_view token) const;
+
+    bool consume(std::string_view token);
+
+    void fail(const char *message);
+  };
+
+  bool is_name_begin(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+
+  bool is_name_char(char c)
+  {
+    return is_name_begin(c) || (c >= '0' && c <= '9');
+  }
+
+  // 10, 0x1f, 017, returns false if str is not a whole number
+  bool parse_number(std::string_view str, long long &value)
+  {
+    int base = 10;
+    if (str.size() > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+    {
+      base = 16;
+      str.remove_prefix(2);
+    }
+    else if (str.size() > 1 && str[0] == '0')
+    {
+      base = 8;
+      str.remove_prefix(1);
+    }
+    unsigned long long u = 0;
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), u, base);
+    if (ec != std::errc{} || end != str.data() + str.size())
+      return false;
+    value = static_cast<long long>(u);
+    return true;
+  }
+
+  // Overflow wraps around instead of being undefined.
+  long long wrap(unsigned long long v) { return static_cast<long long>(v); }
+
+  // By squaring, exp is not negative.
+  long long power(unsigned long long base, long long exp)
+  {
+    unsigned long long r = 1;
+    for (auto e = static_cast<unsigned long long>(exp); e != 0; e >>= 1)
+    {
+      if (e & 1) r *= base;
+      base *= base;
+    }
+    return wrap(r);
+  }
+
+  struct BinaryOperator
+  {
+    std::string_view token;
+    int prec;
+  };
+
+  // the binary operator at the beginning of str, nullptr if none
+  const BinaryOperator *match_binary(std::string_view str)
+  {
+    static constexpr BinaryOperator ops[]{
+            {"||", 1}, {"|", 3}, {"&&", 2}, {"&", 5}, {"^", 4}, {"==", 6}, {"!=", 6},
+            {"<=", 7}, {"<<", 8}, {"<", 7}, {">=", 7}, {">>", 8}, {">", 7},
+            {"+", 9}, {"-", 9}, {"**", 11}, {"*", 10}, {"/", 10}, {"%", 10}};
+    if (str.empty()) return nullptr;
+    char next = str.size() > 1 ? str[1] : '\0';
+    switch (str[0])
+    {
+      case '|': return next == '|' ? &ops[0] : &ops[1];
+      case '&': return next == '&' ? &ops[2] : &ops[3];
+      case '^': return &ops[4];
+      case '=': return next == '=' ? &ops[5] : nullptr;
+      case '!': return next == '=' ? &ops[6] : nullptr;
+      case '<': return next == '=' ? &ops[7] : next == '<' ? &ops[8] : &ops[9];
+      case '>': return next == '=' ? &ops[10] : next == '>' ? &ops[11] : &ops[12];
+      case '+': return &ops[13];
+      case '-': return &ops[14];
+      case '*': return next == '*' ? &ops[15] : &ops[16];
+      case '/': return &ops[17];
+      case '%': return &ops[18];
+      default: return nullptr;
+    }
+  }
+
+  constexpr std::string_view assignment_operators[]{
+          "<<=", ">>=", "**=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", "="};
+
+  int Evaluator::evaluate(long long &result)
+  {
+    result = parse_comma();
+    if (error == nullptr && peek() != '\0')
+      fail("Syntax error");
+    if (error != nullptr)
+    {
+      fmt::println(stderr, "dish: (({})): {}.", expr, error);
+      return -1;
+    }
+    return 0;
+  }
+
+  long long Evaluator::parse_comma()
+  {
+    auto value = parse_assign();
+    while (error == nullptr && consume(","))
+      value = parse_assign();
+    return value;
+  }
+
+  long long Evaluator::parse_assign()
+  {
+    auto saved = pos;
+    if (auto name = parse_name(); !name.empty())
+    {
+      // every assignment operator ends with '=', but '==' is not one
+      peek();
+      auto eq = expr.find('=', pos);
+      bool maybe_assign = eq != std::string_view::npos && eq - pos <= 2 && (eq + 1 == expr.size() || expr[eq + 1] != '=');
+      for (auto op: assignment_operators)
+      {
+        if (!maybe_assign) break;
+        if (!at(op) || (op == "=" && at("==")))
+          continue;
+        pos += op.size();
+        auto rhs = parse_assign();
+        if (error != nullptr) return 0;
+        if (op == "=")
+        {
+          set_variable(name, rhs);
+          return rhs;
+        }
+        // a op= b is a = a op b
+        auto lhs = get_variable(name);
+        std::string_view bop = op.substr(0, op.size() - 1);
+        long long value = 0;
+        if (bop == "+") value = wrap(static_cast<unsigned long long>(lhs) + static_cast<unsigned long long>(rhs));
+        else if (bop == "-") value = wrap(static_cast<unsigned long long>(lhs) - static_cast<unsigned long long>(rhs));
+        else if (bop == "*") value = wrap(static_cast<unsigned long long>(lhs) * static_cast<unsigned long long>(rhs));
+        else if (bop == "&") value = lhs & rhs;
+        else if (bop == "^") value = lhs ^ rhs;
+        else if (bop == "|") value = lhs | rhs;
+        else if (bop == "<<") value = wrap(static_cast<unsigned long long>(lhs) << (rhs & 63));
+        else if (bop == ">>") value = lhs >> (rhs & 63);
+        else if (rhs == 0 && bop != "**")
+        {
+          if (!skip) fail("Division by zero");
+          return 0;
+        }
+        else if (bop == "/") value = (lhs == LLONG_MIN && rhs == -1) ? lhs : lhs / rhs;
+        else if (bop == "%") value = (lhs == LLONG_MIN && rhs == -1) ? 0 : lhs % rhs;
+        else// **
+        {
+          if (rhs < 0)
+          {
+            if (!skip) fail("Exponent less than 0");
+            return 0;
+          }
+          value = power(static_cast<unsigned long long>(lhs), rhs);
+        }
+        set_variable(name, value);
+        return value;
+      }
+    }
+    pos = saved;
+    return parse_ternary();
+  }
+
+  long long Evaluator::parse_ternary()
+  {
+    auto cond = parse_binary(1);
+    if (error != nullptr || !consume("?"))
+      return cond;
+    bool saved = skip;
+    skip = saved || cond == 0;
+    auto lhs = parse_assign();
+    if (error == nullptr && !consume(":"))
+      fail("Expected ':'");
+    skip = saved || cond != 0;
+    auto rhs = parse_ternary();
+    skip = saved;
+    return cond != 0 ? lhs : rhs;
+  }
+
+  long long Evaluator::parse_binary(int min_prec)
+  {
+    auto lhs = parse_unary();
+    while (error == nullptr)
+    {
+      peek();
+      auto op = match_binary(expr.substr(pos));
+      if (op == nullptr || op->prec < min_prec)
+        break;
+      // a op= b is an assignment, not a binary operator
+      auto after = pos + op->token.size();
+      if (after < expr.size() && expr[after] == '=' && op->prec != 6 && op->prec != 7)
+        break;
+      pos = after;
+
+      // && and || do not evaluate the right side if the left side decides
+      bool saved = skip;
+      if (op->token == "&&") skip = saved || lhs == 0;
+      else if (op->token == "||") skip = saved || lhs != 0;
+      // ** is right associative
+      auto rhs = parse_binary(op->token == "**" ? op->prec : op->prec + 1);
+      skip = saved;
+      if (error != nullptr) return 0;
+
+      auto ul = static_cast<unsigned long long>(lhs);
+      auto ur = static_cast<unsigned long long>(rhs);
+      switch (op->token[0])
+      {
+        case '|':
+          lhs = op->token == "||" ? (lhs != 0 || rhs != 0) : (lhs | rhs);
+          break;
+        case '&':
+          lhs = op->token == "&&" ? (lhs != 0 && rhs != 0) : (lhs & rhs);
+          break;
+        case '^':
+          lhs = lhs ^ rhs;
+          break;
+        case '=':
+          lhs = lhs == rhs;
+          break;
+        case '!':
+          lhs = lhs != rhs;
+          break;
+        case '<':
+          if (op->token == "<<") lhs = wrap(ul << (rhs & 63));
+          else if (op->token == "<=") lhs = lhs <= rhs;
+          else lhs = lhs < rhs;
+          break;
+        case '>':
+          if (op->token == ">>") lhs = lhs >> (rhs & 63);
+          else if (op->token == ">=") lhs = lhs >= rhs;
+          else lhs = lhs > rhs;
+          break;
+        case '+':
+          lhs = wrap(ul + ur);
+          break;
+        case '-':
+          lhs = wrap(ul - ur);
+          break;
+        case '*':
+          if (op->token == "**")
+          {
+            // the rest of the operand is still parsed when skipped
+            if (rhs < 0)
+            {
+              if (!skip) fail("Exponent less than 0");
+              lhs = 0;
+              break;
+            }
+            lhs = power(ul, rhs);
+          }
+          else
+            lhs = wrap(ul * ur);
+          break;
+        case '/':
+        case '%':
+          if (rhs == 0)
+          {
+            if (!skip) fail("Division by zero");
+            lhs = 0;
+            break;
+          }
+          if (lhs == LLONG_MIN && rhs == -1)
+            lhs = op->token == "/" ? lhs : 0;
+          else
+            lhs = op->token == "/" ? lhs / rhs : lhs % rhs;
+          break;
+      }
+    }
+    return lhs;
+  }
+
+  long long Evaluator::parse_unary()
+  {
+    // ++i and --i
+    for (std::string_view op: {"++", "--"})
+    {
+      auto saved = pos;
+      if (peek() != op[0] || !consume(op)) continue;
+      if (auto name = parse_name(); !name.empty())
+      {
+        auto value = wrap(static_cast<unsigned long long>(get_variable(name)) + (op == "++" ? 1ull : -1ull));
+        set_variable(name, value);
+        return value;
+      }
+      // - -1
+      pos = saved;
+    }
+    switch (peek())
+    {
+      case '+':
+        ++pos;
+        return parse_unary();
+      case '-':
+        ++pos;
+        return wrap(0ull - static_cast<unsigned long long>(parse_unary()));
+      case '!':
+        ++pos;
+        return parse_unary() == 0;
+      case '~':
+        ++pos;
+        return ~parse_unary();
+      default:
+        break;
+    }
+    return parse_primary();
+  }
+
+  long long Evaluator::parse_primary()
+  {
+    char c = peek();
+    if (c == '(')
+    {
+      ++pos;
+      auto value = parse_comma();
+      if (error == nullptr && !consume(")"))
+        fail("Expected ')'");
+      return value;
+    }
+    if (c >= '0' && c <= '9')
+    {
+      auto beg = pos;
+      while (pos < expr.size() && is_name_char(expr[pos])) ++pos;
+      long long value = 0;
+      if (!parse_number(expr.substr(beg, pos - beg), value))
+        fail("Invalid number");
+      return value;
+    }
+    if (auto name = parse_name(); !name.empty())
+    {
+      auto value = get_variable(name);
+      // i++ and i--
+      if (at("++") || at("--"))
+      {
+        set_variable(name, wrap(static_cast<unsigned long long>(value) + (expr[pos] == '+' ? 1ull : -1ull)));
+        pos += 2;
+      }
+      return value;
+    }
+    fail(c == '\0' ? "Unexpected end of expression" : "Syntax error");
+    return 0;
+  }
+
+  std::string_view Evaluator::parse_name()
+  {
+    peek();
+    auto beg = pos;
+    if (pos < expr.size() && is_name_begin(expr[pos]))
+    {
+      while (pos < expr.size() && is_name_char(expr[pos])) ++pos;
+    }
+    return expr.substr(beg, pos - beg);
+  }
+
+  // Unset and empty variables are 0.
+  long long Evaluator::get_variable(std::string_view name)
+  {
+    auto str = variable::variable_table.get(name);
+    if (str == nullptr || str->empty())
+      return 0;
+    std::string_view value{*str};
+    bool negative = !value.empty() && value[0] == '-';
+    if (negative || (!value.empty() && value[0] == '+'))
+      value.remove_prefix(1);
+    long long ret = 0;
+    if (!parse_number(value, ret))
+    {
+      if (!skip) fail("Value of a variable is not a number");
+      return 0;
+    }
+    return negative ? wrap(0ull - static_cast<unsigned long long>(ret)) : ret;
+  }
+
+  void Evaluator::set_variable(std::string_view name, long long value)
+  {
+    if (skip || error != nullptr) return;
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    variable::variable_table.set(name, std::string_view{buf, static_cast<std::size_t>(end - buf)});
+  }
+
+  char Evaluator::peek()
+  {
+    while (pos < expr.size() && (expr[pos] == ' ' || expr[pos] == '\t' || expr[pos] == '\n'))
+      ++pos;
+    return pos < expr.size() ? expr[pos] : '\0';
+  }
+
+  bool Evaluator::at(std::string_view token) const
+  {
+    return expr.size() - pos >= token.size() && expr.compare(pos, token.size(), token) == 0;
+  }
+
+  bool Evaluator::consume(std::string_view token)
+  {
+    peek();
+    if (!at(token))
+      return false;
+    pos += token.size();
+    return true;
+  }
+
+  void Evaluator::fail(const char *message)
+  {
+    if (error == nullptr)
+      error = message;
+  }
+
+  int evaluate(std::string_view expr, long long &result)
+  {
+    return Evaluator{expr}.evaluate(result);
+  }
+}// namespace dish::arithmetic
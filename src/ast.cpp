@@ -0,0 +1,42 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/ast.hpp"
+
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+
+namespace dish::ast
+{
+  std::pmr::memory_resource *Arena::get_resource() { return &resource; }
+
+  std::string_view Arena::copy(std::string_view str)
+  {
+    if (str.empty()) return {};
+    auto p = static_cast<char *>(resource.allocate(str.size(), 1));
+    std::memcpy(p, str.data(), str.size());
+    return {p, str.size()};
+  }
+
+  Arena &Tree::get_arena() { return arena; }
+
+  std::string_view Tree::get_source() const { return source; }
+
+  void Tree::set_source(std::string_view src) { source = arena.copy(src); }
+
+  const Node *Tree::get_root() const { return root; }
+
+  void Tree::set_root(const Node *node) { root = node; }
+}// namespace dish::ast
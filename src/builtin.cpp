@@ -18,11 +18,14 @@
 #include "dish/dish_lua.hpp"
 #include "dish/job.hpp"
 #include "dish/line_editor.hpp"
+#include "dish/parser.hpp"
 #include "dish/utils.hpp"
+#include "dish/variable.hpp"
 
 #include <unistd.h>
 
 #include <algorithm>
+#include <charconv>
 #include <filesystem>
 #include <list>
 #include <string>
@@ -58,7 +61,7 @@ namespace dish::builtin
         fmt::println(stderr, "cd: {}", strerror(errno));
         return -1;
       }
-      dish_context.lua_state["dish"]["environment"]["PWD"] = home_opt.value().cpp_str();
+      variable::variable_table.set("PWD", home_opt.value().cpp_str());
     }
     else if (args[1] == "-")
     {
@@ -69,7 +72,7 @@ namespace dish::builtin
           fmt::println(stderr, "cd: {}", strerror(errno));
           return -1;
         }
-        dish_context.lua_state["dish"]["environment"]["PWD"] = dish_context.lua_state["dish"]["last_dir"];
+        variable::variable_table.set("PWD", dish_context.lua_state["dish"]["last_dir"].get<std::string>());
       }
       else
       {
@@ -84,7 +87,7 @@ namespace dish::builtin
         fmt::println(stderr, "cd: {}", strerror(errno));
         return -1;
       }
-      dish_context.lua_state["dish"]["environment"]["PWD"] = std::filesystem::current_path().string();
+      variable::variable_table.set("PWD", std::filesystem::current_path().string());
     }
     dish_context.lua_state["dish"]["last_dir"] = last_dir.cpp_str();
     return 0;
@@ -98,12 +101,12 @@ namespace dish::builtin
     }
     else
     {
-      if (auto s = dish_context.lua_state["dish"]["environment"]["PWD"]; s.valid())
-        fmt::println(s.get<std::string>());
+      if (auto s = variable::variable_table.get("PWD"); s != nullptr)
+        fmt::println("{}", *s);
       else
       {
         auto path = std::filesystem::current_path().string();
-        dish_context.lua_state["dish"]["environment"]["PWD"] = path;
+        variable::variable_table.set("PWD", path);
         fmt::println(path);
       }
     }
@@ -114,20 +117,23 @@ namespace dish::builtin
   {
     if (args.size() == 1)
     {
-      for (auto &r: dish_context.lua_state["dish"]["environment"].get<sol::table>())
-        fmt::println("{}={}", r.first.as<std::string>(), r.second.as<std::string>());
+      for (auto &r: variable::variable_table.list())
+      {
+        if (variable::variable_table.is_exported(r.first))
+          fmt::println("{}={}", r.first, r.second);
+      }
     }
     else if (args.size() == 2)
     {
       auto eq = args[1].find('=');
       if (eq != String::npos)
       {
-        auto name = args[1].substr(0, eq);
-        auto value = args[1].substr(eq + 1);
-        dish_context.lua_state["dish"]["environment"][name.cpp_str()] = value.cpp_str();
+        auto name = args[1].substr(0, eq).cpp_str();
+        variable::variable_table.set(name, args[1].substr(eq + 1).cpp_str());
+        variable::variable_table.export_variable(name);
       }
       else
-        dish_context.lua_state["dish"]["environment"][args[1].cpp_str()] = "";
+        variable::variable_table.export_variable(args[1].cpp_str());
     }
     return 0;
   }
@@ -146,23 +152,21 @@ namespace dish::builtin
     }
     else
     {
-      auto it = dish_context.lua_state["dish"]["environment"][args[1].cpp_str()];
-      if (!it.valid())
+      if (variable::variable_table.get(args[1].cpp_str()) == nullptr)
       {
         fmt::println(stderr, "unset: Unknown name.");
         return -1;
       }
-      it = sol::nil;
+      variable::variable_table.erase(args[1].cpp_str());
     }
     return 0;
   }
 
   int builtin_jobs(Args)
   {
-    for (size_t i = 0; i < dish_context.jobs.size(); ++i)
+    job::reap_children();
+    for (auto &job: job::job_table.list())
     {
-      auto &job = utils::list_at(dish_context.jobs, i);
-      job->update_status();
       String job_info;
       if (job->is_completed())
         job_info = job->format_job_info("completed");
@@ -193,20 +197,16 @@ namespace dish::builtin
         fmt::println(stderr, "fg: invalid argument.");
         return -1;
       }
-      if (id - 1 < 0 || id - 1 >= dish_context.jobs.size())
+      job = job::job_table.find(id);
+      if (job == nullptr)
       {
         fmt::println(stderr, "fg: invalid job id.");
         return -1;
       }
-      job = utils::list_at(dish_context.jobs, id - 1);
     }
     else if (args.size() == 1)
     {
-      for (auto it = dish_context.jobs.crbegin(); it != dish_context.jobs.crend(); ++it)
-      {
-        if ((*it)->is_background() || (*it)->is_stopped())
-          job = *it;
-      }
+      job = job::job_table.current();
       if (job == nullptr)
       {
         fmt::println(stderr, "fg: no current job");
@@ -241,20 +241,16 @@ namespace dish::builtin
         fmt::println(stderr, "bg: invalid argument.");
         return -1;
       }
-      if (id - 1 < 0 || id - 1 >= dish_context.jobs.size())
+      job = job::job_table.find(id);
+      if (job == nullptr)
       {
         fmt::println(stderr, "bg: invalid job id.");
         return -1;
       }
-      job = utils::list_at(dish_context.jobs, id - 1);
     }
     else if (args.size() == 1)
     {
-      for (auto it = dish_context.jobs.crbegin(); it != dish_context.jobs.crend(); ++it)
-      {
-        if ((*it)->is_background() || (*it)->is_stopped())
-          job = *it;
-      }
+      job = job::job_table.current();
       if (job == nullptr)
       {
         fmt::println(stderr, "bg: no current job");
@@ -270,18 +266,29 @@ namespace dish::builtin
     return 0;
   }
 
-  int builtin_exit(Args)
+  // exit [n], n is the status of dish -c and scripts
+  int builtin_exit(Args args)
   {
     dish_context.running = false;
-    return 0;
+    if (args.size() < 2)
+      return variable::variable_table.get_last_status();
+    int status = 0;
+    auto str = args[1].cpp_str();
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), status);
+    if (ec != std::errc{} || end != str.data() + str.size())
+    {
+      fmt::println(stderr, "exit: {}: numeric argument required", args[1]);
+      return 2;
+    }
+    return status & 0xff;
   }
 
   int builtin_alias(Args args)
   {
     if (args.size() == 1)
     {
-      for (auto &r: dish_context.lua_state["dish"]["alias"].get<sol::table>())
-        fmt::println("{}={}", r.first.as<std::string>(), r.second.as<std::string>());
+      for (auto &[name, alias]: parser::alias_table.list())
+        fmt::println("{}={}", name, alias);
     }
     else if (args.size() == 2)
     {
@@ -290,13 +297,14 @@ namespace dish::builtin
       {
         auto name = args[1].substr(0, eq);
         auto alias = args[1].substr(eq + 1);
-        dish_context.lua_state["dish"]["alias"][name.cpp_str()] = alias.cpp_str();
+        if (alias.size() > 1 && alias.front() == '"' && alias.back() == '"')
+          alias = alias.substr(1, alias.length() - 2);
+        return parser::alias_table.set(name.cpp_str(), utils::to_view(alias));
       }
       else
       {
-        auto it = dish_context.lua_state["dish"]["alias"][args[1].cpp_str()];
-        if (it.valid())
-          fmt::println("{}={}", args[1], it.get<std::string>());
+        if (auto alias = parser::alias_table.find(args[1].cpp_str()); alias != nullptr)
+          fmt::println("{}={}", args[1], alias->source);
       }
     }
     return 0;
@@ -334,8 +342,8 @@ namespace dish::builtin
     }
     for (auto it = args.cbegin() + 1; it != args.cend(); ++it)
     {
-      if (auto alias = dish_context.lua_state["dish"]["alias"][it->cpp_str()]; alias.valid())
-        fmt::println("{} is an alias for {}", *it, alias.get<std::string>());
+      if (auto alias = parser::alias_table.find(it->cpp_str()); alias != nullptr)
+        fmt::println("{} is an alias for {}", *it, alias->source);
       else
       {
         auto [type, cmd] = utils::find_command(*it);
@@ -345,7 +353,11 @@ namespace dish::builtin
           case utils::CommandType::not_executable:
             fmt::println("{} not found", *it);
             break;
+          case utils::CommandType::function:
+            fmt::println("{} is a shell function", *it);
+            break;
           case utils::CommandType::builtin:
+          case utils::CommandType::native:
             fmt::println("{} is a shell builtin", *it);
             break;
           case utils::CommandType::lua_func:
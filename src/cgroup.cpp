@@ -0,0 +1,313 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "dish/cgroup.hpp"
+#include "dish/job.hpp"
+#include "dish/utils.hpp"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace dish::cgroup
+{
+  bool Limits::empty() const
+  {
+    return memory == 0 && cpu_quota == 0 && pids == 0;
+  }
+
+  bool is_limit_option(std::string_view key)
+  {
+    return key == "memory" || key == "cpu" || key == "pids";
+  }
+
+  int parse_number(std::string_view str, long long &value)
+  {
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc{} && end == str.data() + str.size() && value > 0 ? 0 : -1;
+  }
+
+  int set_limit_option(Limits &limits, std::string_view key, std::string_view value)
+  {
+    if (key == "memory")
+    {
+      // bytes, or with K, M, G or T
+      int shift = 0;
+      if (!value.empty())
+      {
+        auto unit = value.back();
+        for (auto [u, s]: {std::pair{'K', 10}, std::pair{'M', 20}, std::pair{'G', 30}, std::pair{'T', 40}})
+        {
+          if (unit == u || unit == u - 'A' + 'a')
+          {
+            shift = s;
+            value.remove_suffix(1);
+          }
+        }
+      }
+      long long memory;
+      if (parse_number(value, memory) == -1 || memory > (LLONG_MAX >> shift))
+        return -1;
+      limits.memory = memory << shift;
+    }
+    else if (key == "cpu")
+    {
+      // percent of one cpu, e.g. 50% or 200%
+      long long percent;
+      if (value.empty() || value.back() != '%' || parse_number(value.substr(0, value.size() - 1), percent) == -1 ||
+          percent > 100000)
+        return -1;
+      limits.cpu_quota = Limits::cpu_period * percent / 100;
+    }
+    else if (key == "pids")
+    {
+      long long pids;
+      if (parse_number(value, pids) == -1)
+        return -1;
+      limits.pids = pids;
+    }
+    else
+      return -1;
+    return 0;
+  }
+
+  int write_file(const std::string &path, std::string_view data)
+  {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    int ret = job::write_all(fd, data);
+    close(fd);
+    return ret;
+  }
+
+  std::string read_file(const std::string &path)
+  {
+    std::ifstream fs(path);
+    std::stringstream ss;
+    ss << fs.rdbuf();
+    return ss.str();
+  }
+
+  // The value of key in a file of "key value" lines like cpu.stat, 0 if there is none.
+  long long read_key(const std::string &content, std::string_view key)
+  {
+    std::istringstream ss(content);
+    std::string k;
+    long long value;
+    while (ss >> k >> value)
+    {
+      if (k == key)
+        return value;
+    }
+    return 0;
+  }
+
+  // whether a list like cgroup.controllers has word
+  bool has_word(const std::string &list, std::string_view word)
+  {
+    std::istringstream ss(list);
+    for (std::string w; ss >> w;)
+    {
+      if (w == word)
+        return true;
+    }
+    return false;
+  }
+
+  // The cgroup of dish, where the leaves are created, and the controllers enabled for them.
+  // Dish moves itself into a leaf named 'dish' first, since a cgroup other than the root can
+  // not have both processes and controllers for its children. restore_subtree undoes it.
+  struct Subtree
+  {
+    std::string path;
+    std::string controllers;
+    // the ones enabled by dish, which were not before
+    std::vector<std::string> added;
+  };
+
+  const Subtree *get_subtree();
+
+  // At exit, dish moves back to its cgroup if nothing else uses the subtree, i.e. no other dish
+  // shares the leaf 'dish' and no leaf of a job is left, e.g. one of a running background job.
+  void restore_subtree()
+  {
+    auto subtree = get_subtree();
+    auto pid = std::to_string(getpid());
+    if (read_file(subtree->path + "/dish/cgroup.procs") != pid + "\n")
+      return;
+    std::error_code ec;
+    for (auto &entry: std::filesystem::directory_iterator{subtree->path, ec})
+    {
+      if (entry.is_directory(ec) && entry.path().filename() != "dish")
+        return;
+    }
+    for (auto &c: subtree->added)
+      write_file(subtree->path + "/cgroup.subtree_control", "-" + c);
+    if (write_file(subtree->path + "/cgroup.procs", pid) == 0)
+      rmdir((subtree->path + "/dish").c_str());
+  }
+
+  const Subtree *get_subtree()
+  {
+    static const Subtree subtree = []
+    {
+      Subtree ret;
+      std::string mount;
+      std::ifstream mounts("/proc/self/mounts");
+      std::string device, dir, type, rest;
+      while (mounts >> device >> dir >> type && std::getline(mounts, rest))
+      {
+        if (type == "cgroup2")
+        {
+          mount = dir;
+          break;
+        }
+      }
+      std::string own;
+      std::ifstream self("/proc/self/cgroup");
+      for (std::string line; std::getline(self, line);)
+      {
+        if (line.compare(0, 3, "0::") == 0)
+          own = line.substr(3);
+      }
+      if (mount.empty() || own.empty() || own.find(" (deleted)") != std::string::npos)
+        return ret;
+      auto base = own == "/" ? mount : mount + own;
+      if (access((base + "/cgroup.subtree_control").c_str(), W_OK) != 0)
+        return ret;
+      auto pid = std::to_string(getpid());
+      bool moved = false;
+      if (own != "/")
+      {
+        if ((mkdir((base + "/dish").c_str(), 0755) == -1 && errno != EEXIST) ||
+            write_file(base + "/dish/cgroup.procs", pid) == -1)
+          return ret;
+        moved = true;
+      }
+      auto available = read_file(base + "/cgroup.controllers");
+      std::istringstream ss(available);
+      for (std::string c; ss >> c;)
+      {
+        if ((c == "memory" || c == "cpu" || c == "pids") && !has_word(read_file(base + "/cgroup.subtree_control"), c) &&
+            write_file(base + "/cgroup.subtree_control", "+" + c) == 0)
+          ret.added.emplace_back(c);
+      }
+      auto enabled = read_file(base + "/cgroup.subtree_control");
+      if (enabled.find_first_not_of(" \n") == std::string::npos)
+      {
+        // e.g. other processes share the cgroup of dish
+        if (moved)
+        {
+          write_file(base + "/cgroup.procs", pid);
+          rmdir((base + "/dish").c_str());
+        }
+        return ret;
+      }
+      ret.path = base;
+      ret.controllers = " " + enabled + " ";
+      if (moved)
+        std::atexit(restore_subtree);
+      return ret;
+    }();
+    return subtree.path.empty() ? nullptr : &subtree;
+  }
+
+  int Leaf::create(const Limits &limits)
+  {
+    static std::size_t count = 0;
+    auto subtree = get_subtree();
+    if (subtree == nullptr)
+      return -1;
+    auto has = [subtree](std::string_view c)
+    {
+      auto pos = subtree->controllers.find(c);
+      return pos != std::string::npos && std::isspace(subtree->controllers[pos - 1]) &&
+             std::isspace(subtree->controllers[pos + c.size()]);
+    };
+    if ((limits.memory != 0 && !has("memory")) || (limits.cpu_quota != 0 && !has("cpu")) ||
+        (limits.pids != 0 && !has("pids")))
+      return -1;
+    auto leaf = fmt::format("{}/job-{}-{}", subtree->path, getpid(), ++count);
+    if (mkdir(leaf.c_str(), 0755) == -1)
+      return -1;
+    if ((limits.memory != 0 && write_file(leaf + "/memory.max", std::to_string(limits.memory)) == -1) ||
+        (limits.cpu_quota != 0 &&
+         write_file(leaf + "/cpu.max", fmt::format("{} {}", limits.cpu_quota, Limits::cpu_period)) == -1) ||
+        (limits.pids != 0 && write_file(leaf + "/pids.max", std::to_string(limits.pids)) == -1) ||
+        (procs_fd = open((leaf + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC)) == -1)
+    {
+      rmdir(leaf.c_str());
+      return -1;
+    }
+    path = std::move(leaf);
+    return 0;
+  }
+
+  bool Leaf::is_created() const
+  {
+    return !path.empty();
+  }
+
+  int Leaf::enter() const
+  {
+    return job::write_all(procs_fd, "0");
+  }
+
+  Usage Leaf::read() const
+  {
+    Usage ret;
+    auto peak = read_file(path + "/memory.peak");
+    if (!peak.empty())
+      ret.memory_peak = std::stoll(peak);
+    auto cpu = read_file(path + "/cpu.stat");
+    ret.cpu = static_cast<double>(read_key(cpu, "usage_usec")) / 1e6;
+    ret.throttled = static_cast<double>(read_key(cpu, "throttled_usec")) / 1e6;
+    ret.oom_kills = read_key(read_file(path + "/memory.events"), "oom_kill");
+    return ret;
+  }
+
+  void Leaf::remove()
+  {
+    if (procs_fd != -1)
+      close(procs_fd);
+    procs_fd = -1;
+    rmdir(path.c_str());
+    path.clear();
+  }
+
+  void apply_rlimits(const Limits &limits)
+  {
+    auto set = [](int resource, long long value, std::string_view name)
+    {
+      struct rlimit limit{static_cast<rlim_t>(value), static_cast<rlim_t>(value)};
+      if (setrlimit(resource, &limit) == -1)
+        fmt::println(stderr, "on: {}: {}", name, strerror(errno));
+    };
+    if (limits.memory != 0)
+      set(RLIMIT_AS, limits.memory, "memory");
+  }
+}// namespace dish::cgroup
@@ -12,11 +12,14 @@
 //   See the License for the specific language governing permissions and
 //   limitations under the License.
 
+#include "dish/event_loop.hpp"
+#include "dish/interpreter.hpp"
 #include "dish/job.hpp"
 #include "dish/lexer.hpp"
 #include "dish/line_editor.hpp"
 #include "dish/parser.hpp"
 #include "dish/utils.hpp"
+#include "dish/variable.hpp"
 
 #include <pwd.h>
 #include <signal.h>
@@ -24,6 +27,7 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <iostream>
@@ -41,28 +45,179 @@ namespace dish
   {
     return lexer::Lexer(cmd).get_all_tokens_no_check();
   }
-  void sigchld_handler(int sig)
+  String dish_default_prompt()
   {
-    if (!dish_context.waiting)
-      do_job_notification();
+    return (getuid() == 0 ? "# " : "$ ");
   }
 
-  String dish_default_prompt()
+  void set_alias(const std::string &name, sol::object value)
   {
-    return (getuid() == 0 ? "# " : "$ ");
+    if (value.get_type() == sol::type::string)
+      parser::alias_table.set(name, value.as<std::string>());
+    else if (value.get_type() == sol::type::lua_nil)
+      parser::alias_table.erase(name);
+    else
+      fmt::println(stderr, "dish: alias: The alias of '{}' must be a string.", name);
+  }
+
+  void set_environment(const std::string &name, sol::object value)
+  {
+    if (value.get_type() == sol::type::string || value.get_type() == sol::type::number)
+    {
+      variable::variable_table.set(name, value.as<std::string>());
+      variable::variable_table.export_variable(name);
+    }
+    else if (value.get_type() == sol::type::lua_nil)
+      variable::variable_table.erase(name);
+    else
+      fmt::println(stderr, "dish: environment: The value of '{}' must be a string.", name);
+  }
+
+  sol::table to_table(const job::ProcessStats &stats)
+  {
+    return dish_context.lua_state.create_table_with(
+            "real", stats.real, "user", stats.user, "sys", stats.sys, "max_rss", stats.max_rss,
+            "minor_faults", stats.minor_faults, "major_faults", stats.major_faults,
+            "voluntary_switches", stats.voluntary_switches, "involuntary_switches", stats.involuntary_switches);
+  }
+
+  // The stats of the last foreground job, made when dish.last_job_stats is read.
+  sol::object get_last_job_stats()
+  {
+    if (job::last_job == nullptr)
+      return sol::lua_nil;
+    auto stats = to_table(job::last_job->get_stats());
+    stats["status"] = job::last_job->get_exit_status();
+    auto processes = dish_context.lua_state.create_table();
+    for (auto &p: job::last_job->processes)
+    {
+      auto process = to_table(p.stats);
+      process["command"] = p.get_command().cpp_str();
+      processes.add(process);
+    }
+    stats["processes"] = processes;
+    return stats;
+  }
+
+  // dish.alias, dish.environment and dish.func are not fields of dish but proxies of
+  // parser::alias_table, variable::variable_table and dish_context.lua_functions provided by
+  // the metatable of dish, so aliases are compiled once when they are defined, variables are
+  // shared with the interpreter and Lua commands are called without compiling a chunk. Both
+  // 'dish.alias.ls = ...' and 'dish.alias = {...}' work.
+  void init_proxy_tables()
+  {
+    auto &lua = dish_context.lua_state;
+    sol::object next = lua["next"];
+    sol::table alias_proxy = lua.create_table();
+    alias_proxy[sol::metatable_key] = lua.create_table_with(
+            sol::meta_function::index,
+            sol::as_function([](sol::table, const std::string &name) -> sol::object {
+              if (auto alias = parser::alias_table.find(name); alias != nullptr)
+                return sol::make_object(dish_context.lua_state, alias->source);
+              return sol::lua_nil;
+            }),
+            sol::meta_function::new_index,
+            sol::as_function([](sol::table, const std::string &name, sol::object value) { set_alias(name, value); }),
+            sol::meta_function::pairs,
+            sol::as_function([next](sol::table) {
+              auto aliases = dish_context.lua_state.create_table();
+              for (auto &[name, alias]: parser::alias_table.list())
+                aliases[name] = alias;
+              return std::make_tuple(next, aliases, sol::lua_nil);
+            }));
+
+    sol::table environment_proxy = lua.create_table();
+    environment_proxy[sol::metatable_key] = lua.create_table_with(
+            sol::meta_function::index,
+            sol::as_function([](sol::table, const std::string &name) -> sol::object {
+              if (auto value = variable::variable_table.get(name); value != nullptr)
+                return sol::make_object(dish_context.lua_state, *value);
+              return sol::lua_nil;
+            }),
+            sol::meta_function::new_index,
+            sol::as_function([](sol::table, const std::string &name, sol::object value) { set_environment(name, value); }),
+            sol::meta_function::pairs,
+            sol::as_function([next](sol::table) {
+              auto variables = dish_context.lua_state.create_table();
+              for (auto &[name, value]: variable::variable_table.list())
+                variables[name] = value;
+              return std::make_tuple(next, variables, sol::lua_nil);
+            }));
+
+    sol::table func_proxy = lua.create_table();
+    func_proxy[sol::metatable_key] = lua.create_table_with(
+            sol::meta_function::index,
+            sol::as_function([](sol::table, const std::string &name) -> sol::object {
+              if (auto func = dish_context.lua_functions.find(name); func != nullptr)
+                return func->function;
+              return sol::lua_nil;
+            }),
+            sol::meta_function::new_index,
+            sol::as_function([](sol::table, const std::string &name, sol::object value) {
+              dish_context.lua_functions.set(name, value);
+            }),
+            sol::meta_function::pairs,
+            sol::as_function([next](sol::table) {
+              auto functions = dish_context.lua_state.create_table();
+              for (auto &name: dish_context.lua_functions.list())
+                functions[name] = dish_context.lua_functions.find(name)->function;
+              return std::make_tuple(next, functions, sol::lua_nil);
+            }));
+
+    sol::table dish = lua["dish"];
+    dish[sol::metatable_key] = lua.create_table_with(
+            sol::meta_function::index,
+            sol::as_function([alias_proxy, environment_proxy, func_proxy](sol::table, const std::string &key) -> sol::object {
+              if (key == "alias") return alias_proxy;
+              if (key == "environment") return environment_proxy;
+              if (key == "func") return func_proxy;
+              if (key == "last_job_stats") return get_last_job_stats();
+              return sol::lua_nil;
+            }),
+            sol::meta_function::new_index,
+            sol::as_function([](sol::table self, const std::string &key, sol::object value) {
+              if (key == "alias")
+              {
+                parser::alias_table.clear();
+                if (value.get_type() == sol::type::table)
+                {
+                  for (auto &r: value.as<sol::table>())
+                    set_alias(r.first.as<std::string>(), r.second);
+                }
+              }
+              else if (key == "environment")
+              {
+                variable::variable_table.clear();
+                if (value.get_type() == sol::type::table)
+                {
+                  for (auto &r: value.as<sol::table>())
+                    set_environment(r.first.as<std::string>(), r.second);
+                }
+              }
+              else if (key == "func")
+              {
+                dish_context.lua_functions.clear();
+                if (value.get_type() == sol::type::table)
+                {
+                  for (auto &r: value.as<sol::table>())
+                    dish_context.lua_functions.set(r.first.as<std::string>(), r.second);
+                }
+              }
+              else
+                self.raw_set(key, value);
+            }));
   }
 
   // Dish initialize
-  void dish_init()
+  void dish_init(bool interactive)
   {
     dish_context.running = true;
 
     //
     // Terminal
     //
-    dish_context.waiting = false;
     dish_context.terminal = STDIN_FILENO;
-    dish_context.is_interactive = isatty(dish_context.terminal);
+    dish_context.is_interactive = interactive && isatty(dish_context.terminal);
     if (dish_context.is_interactive)
     {
       while (tcgetpgrp(dish_context.terminal) != (dish_context.pgid = getpgrp()))
@@ -73,7 +228,6 @@ namespace dish
       signal(SIGTSTP, SIG_IGN);
       signal(SIGTTIN, SIG_IGN);
       signal(SIGTTOU, SIG_IGN);
-      signal(SIGCHLD, sigchld_handler);
 
       dish_context.pgid = getpid();
       if (setpgid(dish_context.pgid, dish_context.pgid) < 0)
@@ -96,7 +250,6 @@ namespace dish
     // basic table
     dish_context.lua_state["dish"] = dish_context.lua_state.create_table();
     // environment
-    dish_context.lua_state["dish"]["environment"] = dish_context.lua_state.create_table();
     char **envir = environ;
     while (*envir)
     {
@@ -107,22 +260,25 @@ namespace dish
         fmt::println(stderr, "Unexpected env: {}", tmp);
         std::exit(-1);
       }
-      dish_context.lua_state["dish"]["environment"][tmp.substr(0, eq).cpp_str()] = tmp.substr(eq + 1).cpp_str();
+      variable::variable_table.set(tmp.substr(0, eq).cpp_str(), tmp.substr(eq + 1).cpp_str());
       envir++;
     }
-    dish_context.lua_state["dish"]["environment"]["PWD"] = std::filesystem::current_path().string();
-    dish_context.lua_state["dish"]["environment"]["USERNAME"] = getpwuid(getuid())->pw_name;
-    dish_context.lua_state["dish"]["environment"]["HOME"] = getpwuid(getuid())->pw_dir;
-    dish_context.lua_state["dish"]["environment"]["UID"] = std::to_string(getuid());
+    variable::variable_table.set("PWD", std::filesystem::current_path().string());
+    variable::variable_table.set("USERNAME", getpwuid(getuid())->pw_name);
+    // config.lua is found in HOME, which a script can point elsewhere
+    if (variable::variable_table.get("HOME") == nullptr)
+      variable::variable_table.set("HOME", getpwuid(getuid())->pw_dir);
+    variable::variable_table.set("UID", std::to_string(getuid()));
 
-    if (!dish_context.lua_state["dish"]["environment"]["PATH"].valid())
+    if (variable::variable_table.get("PATH") == nullptr)
     {
-      dish_context.lua_state["dish"]["environment"]["PATH"] = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+      variable::variable_table.set("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin");
     }
-    // alias
-    dish_context.lua_state["dish"]["alias"] = dish_context.lua_state.create_table();
-    // lua function
-    dish_context.lua_state["dish"]["func"] = dish_context.lua_state.create_table();
+    // the environment of dish and the above are passed on, the variables set later are not
+    for (auto &r: variable::variable_table.list())
+      variable::variable_table.export_variable(r.first);
+    // alias and environment
+    init_proxy_tables();
     // ret
     dish_context.lua_state["dish"]["last_foreground_ret"] = sol::nil;
     // for cd -
@@ -140,8 +296,40 @@ namespace dish
             []() { return utils::tilde(std::filesystem::current_path().string()).cpp_str(); };
     dish_context.lua_state["dish_get_shrunk_path"] =
             []() { return utils::shrink_path(utils::tilde(std::filesystem::current_path().string())).cpp_str(); };
+    // parse cache
+    dish_context.lua_state["dish_get_parse_cache_stats"] =
+            []() {
+              return dish_context.lua_state.create_table_with(
+                      "hits", parser::parse_cache.get_hits(),
+                      "misses", parser::parse_cache.get_misses(),
+                      "size", parser::parse_cache.size());
+            };
+    // $(cmd) for Lua, without /bin/sh
+    dish_context.lua_state["dish_get_command_output"] =
+            [](const std::string &cmd) -> sol::object {
+              std::string output;
+              if (interpreter::substitute_command(cmd, output) == -1)
+                return sol::lua_nil;
+              return sol::make_object(dish_context.lua_state, output);
+            };
+    // timers, run while the line editor waits for input
+    dish_context.lua_state["dish_add_timer"] =
+            [](int ms, sol::protected_function func) {
+              event_loop::add_timer(std::chrono::milliseconds{ms}, [func] {
+                auto result = func();
+                if (!result.valid())
+                {
+                  sol::error err = result;
+                  fmt::println(stderr, "dish: timer: {}", err.what());
+                }
+              });
+            };
     // complete, hint
     dish_context.lua_state["dish"]["enable_hint"] = true;
+    dish_context.lua_state["dish"]["prefer_external"] = false;
+    dish_context.lua_state["dish"]["pipe_size"] = "default";
+    dish_context.lua_state["dish"]["placement"] = dish_context.lua_state.create_table();
+    dish_context.lua_state["dish"]["limits"] = dish_context.lua_state.create_table();
     dish_context.lua_state["dish"]["hint"] = sol::nil;
     dish_context.lua_state["dish"]["complete"] = sol::nil;
     // Dish Line Editor style
@@ -187,36 +375,32 @@ namespace dish
 
   void run_command(const String &cmd)
   {
-    lexer::Lexer lexer{cmd};
-    auto tokens = lexer.get_all_tokens();
-    if (!tokens.has_value()) return;
-    parser::Parser parser{cmd, tokens.value()};
-    if (parser.parse() == -1) return;
-    dish_context.jobs.emplace_back(std::make_shared<job::Job>(parser.get_cmd()));
-    dish_context.jobs.back()->launch();
+    auto program = parser::parse_cache.get(cmd);
+    if (program == nullptr) return;
+    interpreter::execute(*program);
   }
 
   void do_job_notification()
   {
-    for (auto job_it = dish_context.jobs.begin(); job_it != dish_context.jobs.end();)
+    job::reap_children();
+    // only the jobs with processes marked since the last time, a script does not report them
+    for (auto id: job::job_table.take_changed())
     {
-      auto &job = *job_it;
-      job->update_status();
+      auto job = job::job_table.find(id);
+      if (job == nullptr)
+        continue;
       if (job->is_completed())
       {
-        if (job->is_background())
-          fmt::println("\n{}", job->format_job_info("completed"));
-        job_it = dish_context.jobs.erase(job_it);
+        if (job->is_background() && dish_context.is_interactive)
+          fmt::println("{}", job->format_job_info("completed"));
+        job::job_table.erase(id);
       }
       else if (job->is_stopped() && !job->notified)
       {
-        if (job->is_background())
-          fmt::println("\n{}", job->format_job_info("stopped"));
+        if (job->is_background() && dish_context.is_interactive)
+          fmt::println("{}", job->format_job_info("stopped"));
         job->notified = true;
-        ++job_it;
       }
-      else
-        ++job_it;
     }
     return;
   }
@@ -224,8 +408,8 @@ namespace dish
   std::vector<String> get_path(bool with_curr)
   {
     std::vector<String> ret;
-    if (auto p = dish_context.lua_state["dish"]["environment"]["PATH"]; p.valid())
-      ret = utils::split<std::string_view, std::vector<String>>(p.get<std::string>(), ":");
+    if (auto p = variable::variable_table.get("PATH"); p != nullptr)
+      ret = utils::split<std::string_view, std::vector<String>>(*p, ":");
     if (with_curr)
       ret.emplace_back(std::filesystem::current_path().string());
     return ret;
@@ -18,6 +18,37 @@
 
 namespace dish::lua
 {
+  void FunctionTable::set(const std::string &name, sol::object value)
+  {
+    if (value.get_type() == sol::type::function)
+      functions[name] = Function{value.as<sol::protected_function>(), false};
+    else if (value.get_type() == sol::type::table && value.as<sol::table>()[1].get_type() == sol::type::function)
+    {
+      auto table = value.as<sol::table>();
+      functions[name] = Function{table[1].get<sol::protected_function>(), table["argv"].get_or(false)};
+    }
+    else if (value.get_type() == sol::type::lua_nil)
+      functions.erase(name);
+    else
+      fmt::println(stderr, "dish: func: '{}' must be a function or {{function, argv = true}}.", name);
+  }
+
+  void FunctionTable::clear() { functions.clear(); }
+
+  const FunctionTable::Function *FunctionTable::find(const std::string &name) const
+  {
+    auto it = functions.find(name);
+    return it == functions.end() ? nullptr : &it->second;
+  }
+
+  std::vector<std::string> FunctionTable::list() const
+  {
+    std::vector<std::string> ret;
+    for (auto &r: functions)
+      ret.emplace_back(r.first);
+    return ret;
+  }
+
   sol::protected_function_result dish_sol_error_handler(lua_State *L, sol::protected_function_result pfr)
   {
     std::exception_ptr eptr = std::current_exception();
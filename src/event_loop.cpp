@@ -0,0 +1,200 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/event_loop.hpp"
+#include "dish/job.hpp"
+#include "dish/utils.hpp"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <utility>
+
+namespace dish::event_loop
+{
+  using Clock = std::chrono::steady_clock;
+
+  class EventLoop
+  {
+  private:
+    int epoll_fd;
+    int signal_fd;
+    int timer_fd;
+    int input_fd;// the fd added to epoll by wait()
+    sigset_t signals;
+    std::multimap<Clock::time_point, std::function<void()>> timers;
+
+  public:
+    EventLoop() : epoll_fd(-1), signal_fd(-1), timer_fd(-1), input_fd(-1)
+    {
+      sigemptyset(&signals);
+      sigaddset(&signals, SIGCHLD);
+      sigaddset(&signals, SIGWINCH);
+    }
+
+    unsigned wait(int fd);
+
+    void add_timer(Clock::duration delay, std::function<void()> func);
+
+    void run_timers();
+
+  private:
+    int init();
+
+    int watch(int fd);
+
+    void arm_timer();
+  };
+
+  int EventLoop::init()
+  {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || signal_fd == -1 || timer_fd == -1 || watch(signal_fd) == -1 || watch(timer_fd) == -1)
+    {
+      fmt::println(stderr, "dish: event loop: {}", strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+
+  int EventLoop::watch(int fd)
+  {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  unsigned EventLoop::wait(int fd)
+  {
+    if (epoll_fd == -1 && init() == -1)
+      return input;
+    if (fd != input_fd)
+    {
+      if (input_fd != -1)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, nullptr);
+      if (watch(fd) == -1)
+      {
+        fmt::println(stderr, "dish: event loop: {}", strerror(errno));
+        return input;
+      }
+      input_fd = fd;
+    }
+
+    sigset_t old;
+    sigprocmask(SIG_BLOCK, &signals, &old);
+    unsigned events = 0;
+    // Children that changed state before SIGCHLD was blocked have not been seen by the signalfd.
+    if (job::reap_children())
+      events |= children;
+    while (events == 0)
+    {
+      epoll_event ready[3];
+      int n = epoll_wait(epoll_fd, ready, 3, -1);
+      if (n == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        fmt::println(stderr, "dish: epoll_wait: {}", strerror(errno));
+        events |= input;
+        break;
+      }
+      for (int i = 0; i < n; ++i)
+      {
+        if (ready[i].data.fd == input_fd)
+          events |= input;
+        else if (ready[i].data.fd == signal_fd)
+        {
+          signalfd_siginfo info;
+          bool child = false;
+          while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+          {
+            if (info.ssi_signo == SIGWINCH)
+              events |= resize;
+            else
+              child = true;
+          }
+          // SIGCHLD is also sent for the children already reaped by Job::wait
+          if (child && job::reap_children())
+            events |= children;
+        }
+        else if (ready[i].data.fd == timer_fd)
+        {
+          std::uint64_t expirations;
+          if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            events |= timer;
+        }
+      }
+    }
+    sigprocmask(SIG_SETMASK, &old, nullptr);
+    return events;
+  }
+
+  void EventLoop::add_timer(Clock::duration delay, std::function<void()> func)
+  {
+    if (epoll_fd == -1 && init() == -1)
+      return;
+    timers.emplace(Clock::now() + delay, std::move(func));
+    arm_timer();
+  }
+
+  void EventLoop::run_timers()
+  {
+    auto now = Clock::now();
+    // a timer may add timers
+    while (!timers.empty() && timers.begin()->first <= now)
+    {
+      auto func = std::move(timers.begin()->second);
+      timers.erase(timers.begin());
+      func();
+    }
+    arm_timer();
+  }
+
+  // The timerfd expires at the earliest timer, or never if there is none.
+  void EventLoop::arm_timer()
+  {
+    itimerspec spec{};
+    if (!timers.empty())
+    {
+      auto delay = timers.begin()->first - Clock::now();
+      auto ns = (std::max)(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count(),
+                           std::chrono::nanoseconds::rep{1});
+      spec.it_value.tv_sec = ns / 1000000000;
+      spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+  }
+
+  EventLoop loop;
+
+  unsigned wait(int fd) { return loop.wait(fd); }
+
+  void add_timer(std::chrono::milliseconds delay, std::function<void()> func)
+  {
+    loop.add_timer(delay, std::move(func));
+  }
+
+  void run_timers() { loop.run_timers(); }
+}// namespace dish::event_loop
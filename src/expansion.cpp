@@ -0,0 +1,303 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/expansion.hpp"
+#include "dish/arithmetic.hpp"
+#include "dish/interpreter.hpp"
+#include "dish/utils.hpp"
+#include "dish/variable.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <string_view>
+
+namespace dish::expansion
+{
+  bool is_name_begin(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+
+  bool is_name_char(char c)
+  {
+    return is_name_begin(c) || (c >= '0' && c <= '9');
+  }
+
+  bool is_assignment(std::string_view word)
+  {
+    auto eq = word.find('=');
+    return eq != std::string_view::npos && eq != 0 && is_name_begin(word[0]) &&
+           std::all_of(word.begin(), word.begin() + static_cast<std::ptrdiff_t>(eq), is_name_char);
+  }
+
+  bool is_special(char c)
+  {
+    return c == '?' || c == '$' || c == '#' || c == '@' || c == '*' || (c >= '0' && c <= '9');
+  }
+
+  void append_number(long long n, std::string &out)
+  {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), n);
+    out.append(buf, end);
+  }
+
+  // Appends the value of the parameter to out, returns false if it is unset.
+  bool append_parameter(std::string_view name, std::string &out)
+  {
+    auto &table = variable::variable_table;
+    if (name.size() == 1 && is_special(name[0]) && !(name[0] >= '0' && name[0] <= '9'))
+    {
+      auto args = table.get_args();
+      switch (name[0])
+      {
+        case '?':
+          append_number(table.get_last_status(), out);
+          return true;
+        case '$':
+          append_number(getpid(), out);
+          return true;
+        case '#':
+          append_number(args == nullptr ? 0 : static_cast<long long>(args->size()) - 1, out);
+          return true;
+        default:// @ and *
+          if (args != nullptr)
+          {
+            for (std::size_t i = 1; i < args->size(); ++i)
+            {
+              if (i != 1) out += ' ';
+              out.append((*args)[i].data(), (*args)[i].size());
+            }
+          }
+          return true;
+      }
+    }
+    if (!name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+    {
+      std::size_t n = 0;
+      std::from_chars(name.data(), name.data() + name.size(), n);
+      auto args = table.get_args();
+      if (n == 0)
+      {
+        out += args == nullptr ? "dish" : (*args)[0].cpp_str();
+        return true;
+      }
+      if (args == nullptr || n >= args->size())
+        return false;
+      out.append((*args)[n].data(), (*args)[n].size());
+      return true;
+    }
+    if (auto value = table.get(name); value != nullptr)
+    {
+      out += *value;
+      return true;
+    }
+    return false;
+  }
+
+  // ${...}, body is what is between the braces.
+  int expand_braced(std::string_view body, std::string &out)
+  {
+    // ${#NAME}
+    if (body.size() > 1 && body[0] == '#')
+    {
+      std::string value;
+      append_parameter(body.substr(1), value);
+      // in codepoints
+      append_number(std::count_if(value.begin(), value.end(), [](char c) { return (c & 0xC0) != 0x80; }), out);
+      return 0;
+    }
+    std::size_t name_end = 0;
+    if (!body.empty() && is_special(body[0]) && !(body[0] >= '0' && body[0] <= '9'))
+      name_end = 1;
+    else
+      while (name_end < body.size() && is_name_char(body[name_end])) ++name_end;
+    auto name = body.substr(0, name_end);
+    if (name.empty())
+    {
+      fmt::println(stderr, "dish: ${{{}}}: Bad substitution.", body);
+      return -1;
+    }
+    if (name_end == body.size())
+    {
+      append_parameter(name, out);
+      return 0;
+    }
+
+    auto op = body.substr(name_end);
+    bool colon = op[0] == ':';
+    if (colon) op.remove_prefix(1);
+    if (op.empty() || (op[0] != '-' && op[0] != '=' && op[0] != '+'))
+    {
+      fmt::println(stderr, "dish: ${{{}}}: Bad substitution.", body);
+      return -1;
+    }
+    auto word = op.substr(1);
+    auto beg = out.size();
+    bool set = append_parameter(name, out);
+    // with ':', an empty value counts as unset
+    if (colon && out.size() == beg) set = false;
+    switch (op[0])
+    {
+      case '-':
+        if (!set) return expand(word, out);
+        break;
+      case '=':
+        if (!set)
+        {
+          if (!is_name_begin(name[0]))
+          {
+            fmt::println(stderr, "dish: ${}: Can not assign in this way.", name);
+            return -1;
+          }
+          if (expand(word, out) == -1) return -1;
+          variable::variable_table.set(name, std::string_view{out}.substr(beg));
+        }
+        break;
+      case '+':
+        out.resize(beg);
+        if (set) return expand(word, out);
+        break;
+    }
+    return 0;
+  }
+
+  int expand_arithmetic(std::string_view expr, std::string &out)
+  {
+    // parameters and quotes in the expression are expanded first
+    std::string expanded;
+    if (expr.find_first_of("$\"") != std::string_view::npos)
+    {
+      if (expand(expr, expanded) == -1)
+        return -1;
+      expr = expanded;
+    }
+    long long value = 0;
+    if (arithmetic::evaluate(expr, value) == -1)
+      return -1;
+    append_number(value, out);
+    return 0;
+  }
+
+  // $... in word, pos is after the '$' and is moved to the end of it.
+  int expand_dollar(std::string_view word, std::size_t &pos, std::string &out)
+  {
+    if (pos == word.size())
+      out += '$';
+    else if (word[pos] == '{')
+    {
+      // the matching '}', allowing nested ${...} in the word of ${NAME:-word}
+      std::size_t depth = 1;
+      std::size_t end = pos + 1;
+      for (; end < word.size(); ++end)
+      {
+        if (word[end] == '{' && word[end - 1] == '$')
+          ++depth;
+        else if (word[end] == '}' && --depth == 0)
+          break;
+      }
+      if (end == word.size())
+      {
+        fmt::println(stderr, "dish: {}: Bad substitution.", word);
+        return -1;
+      }
+      if (expand_braced(word.substr(pos + 1, end - pos - 1), out) == -1)
+        return -1;
+      pos = end + 1;
+    }
+    else if (word[pos] == '(')
+    {
+      auto end = utils::find_matching_paren(word, pos);
+      if (end == std::string_view::npos)
+      {
+        fmt::println(stderr, "dish: {}: Bad substitution.", word);
+        return -1;
+      }
+      // $((expr))
+      if (word[pos + 1] == '(' && word[end - 1] == ')')
+      {
+        if (expand_arithmetic(word.substr(pos + 2, end - pos - 3), out) == -1)
+          return -1;
+      }
+      // $(command)
+      else if (interpreter::substitute_command(word.substr(pos + 1, end - pos - 1), out) == -1)
+        return -1;
+      pos = end + 1;
+    }
+    else if (is_special(word[pos]))
+    {
+      append_parameter(word.substr(pos, 1), out);
+      ++pos;
+    }
+    else if (is_name_begin(word[pos]))
+    {
+      auto end = pos;
+      while (end < word.size() && is_name_char(word[end])) ++end;
+      append_parameter(word.substr(pos, end - pos), out);
+      pos = end;
+    }
+    else
+      out += '$';
+    return 0;
+  }
+
+  int expand(std::string_view word, std::string &out, bool *glob)
+  {
+    bool quoted = false;
+    if (glob != nullptr)
+      *glob = !word.empty() && word[0] == '~';
+    for (std::size_t pos = 0; pos < word.size();)
+    {
+      // copy the plain run at once
+      auto next = word.find_first_of("\"$*?", pos);
+      if (next == std::string_view::npos) next = word.size();
+      out.append(word.data() + pos, next - pos);
+      pos = next;
+      if (pos == word.size()) break;
+
+      char c = word[pos];
+      if (c == '"')
+      {
+        quoted = !quoted;
+        ++pos;
+      }
+      else if (c == '*' || c == '?')
+      {
+        if (!quoted && glob != nullptr) *glob = true;
+        out += c;
+        ++pos;
+      }
+      else if (expand_dollar(word, ++pos, out) == -1)
+        return -1;
+    }
+    return 0;
+  }
+
+  int expand_heredoc(std::string_view body, std::string &out)
+  {
+    for (std::size_t pos = 0; pos < body.size();)
+    {
+      auto next = (std::min)(body.find('$', pos), body.size());
+      out.append(body.data() + pos, next - pos);
+      pos = next;
+      if (pos == body.size()) break;
+      if (expand_dollar(body, ++pos, out) == -1)
+        return -1;
+    }
+    return 0;
+  }
+}// namespace dish::expansion
@@ -0,0 +1,796 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/interpreter.hpp"
+#include "dish/ast.hpp"
+#include "dish/dish.hpp"
+#include "dish/expansion.hpp"
+#include "dish/job.hpp"
+#include "dish/parser.hpp"
+#include "dish/utils.hpp"
+#include "dish/variable.hpp"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dish::interpreter
+{
+  std::unordered_map<std::string, std::shared_ptr<const Program>> functions;
+  // the status of the last $(...), for the one of an assignment
+  int substitution_status = -1;
+  constexpr std::size_t max_call_depth = 1024;
+
+  // Reused by every word, so expanding does not allocate once it has grown.
+  std::string expansion_buffer;
+
+  // parameters, quotes, ~ and globs
+  int expand_raw_word(std::string_view text, std::vector<String> &out)
+  {
+    expansion_buffer.clear();
+    bool glob = false;
+    if (expansion::expand(text, expansion_buffer, &glob) == -1)
+      return -1;
+    if (glob)
+      utils::expand(String{expansion_buffer}, out);
+    else
+      out.emplace_back(expansion_buffer);
+    return 0;
+  }
+
+  // Whether the '(' after the first character is closed by the last character.
+  bool is_parenthesized(std::string_view text)
+  {
+    if (text.size() < 3 || text[1] != '(' || text.back() != ')')
+      return false;
+    return utils::find_matching_paren(text, 1) + 1 == text.size();
+  }
+
+  // A word that is only an unquoted $(command), whose output is split into words by spaces,
+  // tabs and newlines, e.g. for i in $(seq 10).
+  bool is_split_word(std::string_view text)
+  {
+    return is_parenthesized(text) && text[0] == '$' && text[2] != '(';
+  }
+
+  // <(command) or >(command), the lexer only makes them at the start of a word
+  bool is_process_substitution(std::string_view text)
+  {
+    return is_parenthesized(text) && (text[0] == '<' || text[0] == '>');
+  }
+
+  // The command runs as a process of the job, the word is a path to its end of the pipe.
+  int substitute_process(std::string_view text, job::Job &job, std::vector<String> &out)
+  {
+    auto program = parser::parse_cache.get(utils::to_string(text.substr(2, text.size() - 3)));
+    if (program == nullptr)
+      return -1;
+    auto path = job.insert_substitution(std::move(program), text[0] == '<');
+    if (path.empty())
+      return -1;
+    out.emplace_back(std::move(path));
+    return 0;
+  }
+
+  int expand_word(const ast::Word &word, std::vector<String> &out)
+  {
+    if (is_split_word(word.text))
+    {
+      expansion_buffer.clear();
+      if (expansion::expand(word.text, expansion_buffer) == -1)
+        return -1;
+      std::string_view output{expansion_buffer};
+      for (auto beg = output.find_first_not_of(" \t\n"); beg != std::string_view::npos;)
+      {
+        auto end = (std::min)(output.find_first_of(" \t\n", beg), output.size());
+        out.emplace_back(utils::to_string(output.substr(beg, end - beg)));
+        beg = output.find_first_not_of(" \t\n", end);
+      }
+      return 0;
+    }
+    // $@ and "$@" are one word per argument
+    if (word.text == "$@" || word.text == "\"$@\"")
+    {
+      if (auto args = variable::variable_table.get_args(); args != nullptr)
+        out.insert(out.end(), args->begin() + 1, args->end());
+      return 0;
+    }
+    if (!utils::has_braces(word.text))
+      return expand_raw_word(word.text, out);
+    // braces are expanded first, each word goes straight into out
+    std::string raw;
+    for (utils::BraceExpansion braces{word.text}; braces.next(raw);)
+    {
+      if (expand_raw_word(raw, out) == -1)
+        return -1;
+    }
+    return 0;
+  }
+
+  // A brace word that needs no other expansion, e.g. {1..100000}, is generated by a for loop
+  // while iterating instead of being expanded before.
+  bool is_lazy_word(const ast::Word &word)
+  {
+    return word.text.find_first_of("\"$*?~") == std::string_view::npos && utils::has_braces(word.text);
+  }
+
+  // Patterns, the word of case and redirection targets are not globbed or split.
+  std::optional<String> expand_single_word(std::string_view text)
+  {
+    expansion_buffer.clear();
+    if (expansion::expand(text, expansion_buffer) == -1)
+      return std::nullopt;
+    return String{expansion_buffer};
+  }
+
+  bool case_match(const ast::CaseItem &item, const String &word)
+  {
+    for (auto &p: item.patterns)
+    {
+      auto pattern = expand_single_word(p.text);
+      if (pattern.has_value() && fnmatch(pattern->c_str(), word.c_str(), 0) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  // the target of <& and >&, -1 if it is not a valid fd
+  int to_fd(const String &target)
+  {
+    if (target.empty() || target.size() > 4)
+      return -1;
+    for (auto ch: target)
+    {
+      if (ch < '0' || ch > '9')
+        return -1;
+    }
+    return std::stoi(target.cpp_str());
+  }
+
+  int instantiate_redirect(const ast::Redirect &r, job::Process &scmd, job::Job &job)
+  {
+    using job::RedirectType;
+    if (r.type == lexer::TokenType::lt_lt)//<<
+    {
+      int fd = r.fd == -1 ? 0 : r.fd;
+      if (r.quoted)
+        scmd.insert_redirect(job::Redirect{RedirectType::here, fd, utils::to_string(r.target)});
+      else
+      {
+        expansion_buffer.clear();
+        if (expansion::expand_heredoc(r.target, expansion_buffer) == -1)
+          return -1;
+        scmd.insert_redirect(job::Redirect{RedirectType::here, fd, String{expansion_buffer}});
+      }
+      return 0;
+    }
+    std::optional<String> expanded;
+    // > >(command) and < <(command) redirect to the pipe of the substitution
+    if (is_process_substitution(r.target))
+    {
+      std::vector<String> path;
+      if (substitute_process(r.target, job, path) == -1)
+        return -1;
+      expanded = std::move(path.front());
+    }
+    else
+      expanded = expand_single_word(r.target);
+    if (!expanded.has_value())
+      return -1;
+    auto &target = *expanded;
+    auto redirect_fd = [&r](int fd) { return r.fd == -1 ? fd : r.fd; };
+    switch (r.type)
+    {
+      case lexer::TokenType::lt://<
+        scmd.insert_redirect(job::Redirect{RedirectType::input, redirect_fd(0), target});
+        break;
+      case lexer::TokenType::rt://>
+        scmd.insert_redirect(job::Redirect{RedirectType::overwrite, redirect_fd(1), target});
+        break;
+      case lexer::TokenType::lt_lt_lt://<<<
+        target += '\n';
+        scmd.insert_redirect(job::Redirect{RedirectType::here, redirect_fd(0), target});
+        break;
+      case lexer::TokenType::rt_rt://>>
+        scmd.insert_redirect(job::Redirect{RedirectType::append, redirect_fd(1), target});
+        break;
+      case lexer::TokenType::lt_rt://<>
+        scmd.insert_redirect(job::Redirect{RedirectType::read_write, redirect_fd(0), target});
+        break;
+      case lexer::TokenType::lt_and://<&
+      case lexer::TokenType::rt_and://>&
+      {
+        int fd = redirect_fd(r.type == lexer::TokenType::lt_and ? 0 : 1);
+        if (target == "-")
+        {
+          scmd.insert_redirect(job::Redirect{RedirectType::close, fd, -1});
+          break;
+        }
+        int from = to_fd(target);
+        if (from == -1)
+        {
+          fmt::println(stderr, "dish: {}: Bad file descriptor", target);
+          return -1;
+        }
+        scmd.insert_redirect(job::Redirect{RedirectType::fd, fd, from});
+        break;
+      }
+      default:
+        break;
+    }
+    // &> file is > file 2>&1
+    if (r.with_stderr)
+      scmd.insert_redirect(job::Redirect{RedirectType::fd, 2, 1});
+    return 0;
+  }
+
+  // pipe_size=SIZE of the pipeline, or dish.pipe_size. Returns -2 if it is invalid.
+  int get_pipe_size(const ast::Pipeline &pipeline)
+  {
+    if (!pipeline.pipe_size.empty())
+      return job::parse_pipe_size(pipeline.pipe_size);
+    sol::object value = dish_context.lua_state["dish"]["pipe_size"];
+    if (value.get_type() == sol::type::number)
+    {
+      auto size = value.as<double>();
+      return size > 0 && size <= INT_MAX ? static_cast<int>(size) : -2;
+    }
+    if (value.get_type() == sol::type::string)
+      return job::parse_pipe_size(value.as<std::string>());
+    return job::default_pipe_size;
+  }
+
+  // Calls set(key, value) for each field of a table like dish.placement. Returns -1 if set fails.
+  int for_each_option(const char *table, const std::function<int(std::string_view, std::string_view)> &set)
+  {
+    sol::object defaults = dish_context.lua_state["dish"][table];
+    if (defaults.get_type() != sol::type::table)
+      return 0;
+    for (auto &[key, value]: defaults.as<sol::table>())
+    {
+      if (key.get_type() != sol::type::string)
+        continue;
+      auto name = key.as<std::string>();
+      std::string text;
+      if (value.get_type() == sol::type::boolean)
+        text = value.as<bool>() ? "true" : "false";
+      else if (value.get_type() == sol::type::number)
+        text = std::to_string(value.as<long long>());
+      else if (value.get_type() == sol::type::string)
+        text = value.as<std::string>();
+      if (set(name, text) == -1)
+      {
+        fmt::println(stderr, "dish.{}: Invalid {} '{}'.", table, name, text);
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  // dish.placement and dish.limits, then the options of 'on'. Returns -1 if an option is invalid.
+  int get_job_options(const ast::Pipeline &pipeline, job::Placement &placement, cgroup::Limits &limits)
+  {
+    if (for_each_option("placement", [&placement](std::string_view key, std::string_view value)
+                        { return job::set_placement_option(placement, key, value); }) == -1 ||
+        for_each_option("limits", [&limits](std::string_view key, std::string_view value)
+                        { return cgroup::set_limit_option(limits, key, value); }) == -1)
+      return -1;
+    for (auto option: pipeline.placement)
+    {
+      auto eq = option.find('=');
+      auto key = option.substr(0, eq);
+      auto value = eq == std::string_view::npos ? std::string_view{} : option.substr(eq + 1);
+      if (eq == std::string_view::npos ||
+          (cgroup::is_limit_option(key) ? cgroup::set_limit_option(limits, key, value)
+                                        : job::set_placement_option(placement, key, value)) == -1)
+      {
+        fmt::println(stderr, "on: Invalid option '{}'.", option);
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  int instantiate(const ast::Pipeline &pipeline, job::Job &job)
+  {
+    job::Placement placement;
+    cgroup::Limits limits;
+    if (get_job_options(pipeline, placement, limits) == -1)
+      return -1;
+    job.set_placement(std::move(placement));
+    job.set_limits(limits);
+    if (!pipeline.placement.empty())
+      job.set_explicit_options();
+    // only read when there are pipes
+    if (pipeline.commands.size() > 1)
+    {
+      int pipe_size = get_pipe_size(pipeline);
+      if (pipe_size == -2)
+      {
+        fmt::println(stderr, "pipe_size: Invalid size, expected a number of bytes like 1M, 'adaptive' or 'default'.");
+        return -1;
+      }
+      job.set_pipe_size(pipe_size);
+    }
+    std::vector<String> args;
+    auto redirect = pipeline.redirects.cbegin();
+    for (std::size_t i = 0; i < pipeline.commands.size(); ++i)
+    {
+      job::Process scmd;
+      args.clear();
+      for (auto &w: pipeline.commands[i]->words)
+      {
+        if (is_process_substitution(w.text))
+        {
+          if (substitute_process(w.text, job, args) == -1)
+            return -1;
+        }
+        else if (expand_word(w, args) == -1)
+          return -1;
+      }
+      for (auto &r: args)
+        scmd.insert(std::move(r));
+      // each command has its own fd table, e.g. cmd 2>/dev/null | cmd2 >file
+      for (; redirect != pipeline.redirects.cend() && redirect->command == i; ++redirect)
+      {
+        if (instantiate_redirect(*redirect, scmd, job) == -1)
+          return -1;
+      }
+      job.insert(scmd);
+    }
+    if (pipeline.background)
+      job.set_background();
+    return 0;
+  }
+
+  // The values are expanded like the word of ${NAME:=word}, without splitting or globbing. The
+  // status is the one of the last $(...) in them, or 0.
+  int assign(const ast::Command &command)
+  {
+    substitution_status = -1;
+    std::string value;
+    for (auto &w: command.words)
+    {
+      auto eq = w.text.find('=');
+      value.clear();
+      if (expansion::expand(w.text.substr(eq + 1), value) == -1)
+        return 1;
+      variable::variable_table.set(w.text.substr(0, eq), value);
+    }
+    return substitution_status == -1 ? 0 : substitution_status;
+  }
+
+  int execute_pipeline(const ast::Pipeline &pipeline)
+  {
+    auto job = std::make_shared<job::Job>(utils::to_string(pipeline.text));
+    if (instantiate(pipeline, *job) == -1)
+    {
+      job->close_substitution_fds();
+      return 1;
+    }
+    job::job_table.insert(job);
+    if (job->launch() != 0)
+    {
+      job->close_substitution_fds();
+      job::job_table.erase(job->id);
+      return job->get_exit_status();
+    }
+    if (pipeline.background)
+      return 0;
+    if (job->is_completed())
+    {
+      job::last_job = job;
+      if (pipeline.timed)
+        job->print_stats();
+    }
+    return job->get_exit_status();
+  }
+
+  void Compiler::compile(const ast::Node *node)
+  {
+    switch (node->type)
+    {
+      case ast::NodeType::list:
+        compile_list(ast::as<ast::List>(node));
+        break;
+      case ast::NodeType::pipeline:
+        compile_pipeline(ast::as<ast::Pipeline>(node));
+        break;
+      case ast::NodeType::if_clause:
+        compile_if(ast::as<ast::IfClause>(node));
+        break;
+      case ast::NodeType::for_clause:
+        compile_for(ast::as<ast::ForClause>(node));
+        break;
+      case ast::NodeType::while_clause:
+        compile_while(ast::as<ast::WhileClause>(node));
+        break;
+      case ast::NodeType::case_clause:
+        compile_case(ast::as<ast::CaseClause>(node));
+        break;
+      case ast::NodeType::function_def:
+        emit(OpCode::define, node);
+        break;
+      case ast::NodeType::command:
+      case ast::NodeType::case_item:
+        break;
+    }
+  }
+
+  std::size_t Compiler::emit(OpCode op, const ast::Node *node, std::uint32_t target)
+  {
+    code.emplace_back(Instruction{op, target, node});
+    return code.size() - 1;
+  }
+
+  void Compiler::patch(std::size_t pos) { code[pos].target = here(); }
+
+  std::uint32_t Compiler::here() const { return static_cast<std::uint32_t>(code.size()); }
+
+  // The status of a skipped item is not recorded, so 'false && a || b' runs b.
+  void Compiler::compile_list(const ast::List &list)
+  {
+    for (auto &item: list.items)
+    {
+      if (item.connector == ast::Connector::seq)
+        compile(item.node);
+      else
+      {
+        auto skip = emit(item.connector == ast::Connector::and_and ? OpCode::jump_if_false : OpCode::jump_if_true);
+        compile(item.node);
+        patch(skip);
+      }
+    }
+  }
+
+  void Compiler::compile_pipeline(const ast::Pipeline &pipeline)
+  {
+    auto &words = pipeline.commands[0]->words;
+    bool simple = pipeline.commands.size() == 1 && pipeline.redirects.empty() && !pipeline.background;
+    // NAME=value..., without a command
+    if (simple && std::all_of(words.begin(), words.end(), [](const ast::Word &w)
+                              { return w.type == lexer::TokenType::word && expansion::is_assignment(w.text); }))
+    {
+      emit(OpCode::assign, pipeline.commands[0]);
+      return;
+    }
+    // return [n]
+    if (in_function && simple && words[0].type == lexer::TokenType::word && words[0].text == "return" &&
+        words.size() <= 2)
+    {
+      if (words.size() == 2)
+      {
+        auto n = words[1].text;
+        if (n.empty() || !std::all_of(n.begin(), n.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+          emit(OpCode::run, &pipeline);// let it fail as a command
+          return;
+        }
+        emit(OpCode::set_status, nullptr, static_cast<std::uint32_t>(std::stoul(std::string{n}) & 0xff));
+      }
+      emit(OpCode::ret);
+      return;
+    }
+    // break and continue are jumps to the innermost loop.
+    if (!loops.empty() && simple && words.size() == 1 && words[0].type == lexer::TokenType::word &&
+        (words[0].text == "break" || words[0].text == "continue"))
+    {
+      for (auto i = loops.back().case_depth; i < case_depth; ++i)
+        emit(OpCode::case_end);
+      if (words[0].text == "break")
+        loops.back().breaks.emplace_back(emit(OpCode::jump));
+      else
+        emit(OpCode::jump, nullptr, loops.back().continue_target);
+      return;
+    }
+    emit(OpCode::run, &pipeline);
+  }
+
+  void Compiler::compile_if(const ast::IfClause &node)
+  {
+    std::vector<std::size_t> ends;
+    for (auto &branch: node.branches)
+    {
+      compile_list(*branch.cond);
+      auto next = emit(OpCode::jump_if_false);
+      compile_list(*branch.body);
+      ends.emplace_back(emit(OpCode::jump));
+      patch(next);
+    }
+    if (node.else_body != nullptr)
+      compile_list(*node.else_body);
+    else
+      emit(OpCode::set_status, nullptr, 0);
+    for (auto &r: ends)
+      patch(r);
+  }
+
+  void Compiler::compile_for(const ast::ForClause &node)
+  {
+    emit(OpCode::loop_enter);
+    emit(OpCode::for_begin, &node);
+    auto top = here();
+    auto exit = emit(OpCode::for_next, &node);
+    loops.emplace_back(Loop{top, {}, case_depth});
+    compile_list(*node.body);
+    emit(OpCode::loop_store);
+    emit(OpCode::jump, nullptr, top);
+    patch(exit);
+    for (auto &r: loops.back().breaks)
+      patch(r);
+    loops.pop_back();
+    emit(OpCode::for_end);
+    emit(OpCode::loop_exit);
+  }
+
+  void Compiler::compile_while(const ast::WhileClause &node)
+  {
+    emit(OpCode::loop_enter);
+    auto top = here();
+    compile_list(*node.cond);
+    auto exit = emit(node.until ? OpCode::jump_if_true : OpCode::jump_if_false);
+    loops.emplace_back(Loop{top, {}, case_depth});
+    compile_list(*node.body);
+    emit(OpCode::loop_store);
+    emit(OpCode::jump, nullptr, top);
+    patch(exit);
+    for (auto &r: loops.back().breaks)
+      patch(r);
+    loops.pop_back();
+    emit(OpCode::loop_exit);
+  }
+
+  void Compiler::compile_case(const ast::CaseClause &node)
+  {
+    emit(OpCode::case_begin, &node);
+    ++case_depth;
+    std::vector<std::size_t> ends;
+    for (auto &item: node.items)
+    {
+      auto next = emit(OpCode::case_match, item);
+      compile_list(*item->body);
+      ends.emplace_back(emit(OpCode::jump));
+      patch(next);
+    }
+    for (auto &r: ends)
+      patch(r);
+    --case_depth;
+    emit(OpCode::case_end);
+  }
+
+  std::shared_ptr<const Program> compile(std::shared_ptr<const ast::Tree> tree)
+  {
+    auto program = std::make_shared<Program>();
+    program->tree = std::move(tree);
+    Compiler{program->code}.compile(program->tree->get_root());
+    return program;
+  }
+
+  int call_function(const Program &function, const std::vector<String> &args)
+  {
+    auto &table = variable::variable_table;
+    if (table.get_call_depth() == max_call_depth)
+    {
+      fmt::println(stderr, "dish: {}: Maximum function nesting level exceeded.", args[0]);
+      return 1;
+    }
+    table.push_args(&args);
+    int status = execute(function);
+    table.pop_args();
+    return status;
+  }
+
+  int execute(const Program &program)
+  {
+    struct ForState
+    {
+      std::string_view name;
+      std::vector<String> words;
+      std::size_t next;
+      // the lazy words and where they are in words
+      std::vector<std::pair<std::size_t, std::string_view>> generators;
+      std::size_t next_generator;
+      std::optional<utils::BraceExpansion> braces;
+      std::string generated;
+    };
+    int status = 0;
+    std::vector<int> loop_status;
+    std::vector<ForState> fors;
+    std::vector<String> case_words;
+    auto &code = program.code;
+    std::size_t pc = 0;
+    while (pc < code.size() && dish_context.running)
+    {
+      auto &ins = code[pc++];
+      switch (ins.op)
+      {
+        case OpCode::run:
+          status = execute_pipeline(ast::as<ast::Pipeline>(ins.node));
+          // Ctrl-C stops the whole line, e.g. a loop, not only the command.
+          if (status == 128 + SIGINT)
+            return status;
+          break;
+        case OpCode::assign:
+          status = assign(ast::as<ast::Command>(ins.node));
+          break;
+        case OpCode::jump:
+          pc = ins.target;
+          break;
+        case OpCode::jump_if_true:
+          if (status == 0) pc = ins.target;
+          break;
+        case OpCode::jump_if_false:
+          if (status != 0) pc = ins.target;
+          break;
+        case OpCode::set_status:
+          status = static_cast<int>(ins.target);
+          break;
+        case OpCode::loop_enter:
+          loop_status.emplace_back(0);
+          break;
+        case OpCode::loop_store:
+          loop_status.back() = status;
+          break;
+        case OpCode::loop_exit:
+          status = loop_status.back();
+          loop_status.pop_back();
+          break;
+        case OpCode::for_begin: {
+          auto &node = ast::as<ast::ForClause>(ins.node);
+          auto &f = fors.emplace_back(ForState{node.name, {}, 0, {}, 0, std::nullopt, {}});
+          if (auto args = variable::variable_table.get_args(); node.positional && args != nullptr)
+            f.words.assign(args->begin() + 1, args->end());
+          for (auto &w: node.words)
+          {
+            if (is_lazy_word(w))
+              f.generators.emplace_back(f.words.size(), w.text);
+            else if (expand_word(w, f.words) == -1)
+            {
+              f.words.clear();
+              f.generators.clear();
+              status = 1;
+              break;
+            }
+          }
+        }
+        break;
+        case OpCode::for_next: {
+          auto &f = fors.back();
+          while (!f.braces.has_value() && f.next_generator < f.generators.size() &&
+                 f.generators[f.next_generator].first == f.next)
+          {
+            f.braces.emplace(f.generators[f.next_generator++].second);
+            if (!f.braces->next(f.generated))
+              f.braces.reset();
+          }
+          if (f.braces.has_value())
+          {
+            variable::variable_table.set(f.name, f.generated);
+            if (!f.braces->next(f.generated))
+              f.braces.reset();
+          }
+          else if (f.next < f.words.size())
+          {
+            auto &w = f.words[f.next++];
+            variable::variable_table.set(f.name, std::string_view{w.data(), w.size()});
+          }
+          else
+            pc = ins.target;
+        }
+        break;
+        case OpCode::for_end:
+          fors.pop_back();
+          break;
+        case OpCode::case_begin:
+          case_words.emplace_back(expand_single_word(ast::as<ast::CaseClause>(ins.node).word.text).value_or(String{}));
+          status = 0;
+          break;
+        case OpCode::case_match:
+          if (!case_match(ast::as<ast::CaseItem>(ins.node), case_words.back()))
+            pc = ins.target;
+          break;
+        case OpCode::case_end:
+          case_words.pop_back();
+          break;
+        case OpCode::define: {
+          auto &node = ast::as<ast::FunctionDef>(ins.node);
+          auto function = std::make_shared<Program>();
+          function->tree = program.tree;
+          Compiler{function->code, true}.compile(node.body);
+          functions[std::string{node.name}] = std::move(function);
+          status = 0;
+        }
+        break;
+        case OpCode::ret:
+          return status;
+      }
+      variable::variable_table.set_last_status(status);
+    }
+    return status;
+  }
+
+  int substitute_command(std::string_view line, std::string &out)
+  {
+    auto program = parser::parse_cache.get(utils::to_string(line));
+    if (program == nullptr)
+      return -1;
+    // A memfd instead of a pipe, so nothing has to read while the command runs. A command run
+    // in dish writes from the only thread of dish, it would block on a full pipe.
+    int fd = memfd_create("dish-substitution", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+      fmt::println(stderr, "memfd_create: {}", strerror(errno));
+      return -1;
+    }
+
+    // The command may expand words, which uses expansion_buffer, and out may be it. Both are
+    // moved away until it finishes.
+    std::string result;
+    std::string saved_buffer;
+    result.swap(out);
+    saved_buffer.swap(expansion_buffer);
+    auto beg = result.size();
+
+    int saved_capture = job::stdout_capture;
+    job::stdout_capture = fd;
+    // exit ends the substitution with its status, not dish
+    bool running = dish_context.running;
+    int status = execute(*program);
+    dish_context.running = running;
+    job::stdout_capture = saved_capture;
+    variable::variable_table.set_last_status(status);
+    substitution_status = status;
+
+    // The background jobs of the command may still write, what they wrote so far is read.
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+      result.resize(beg + static_cast<std::size_t>(st.st_size));
+      std::size_t size = beg;
+      while (size < result.size())
+      {
+        auto n = pread(fd, result.data() + size, result.size() - size, static_cast<off_t>(size - beg));
+        if (n == -1 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        size += static_cast<std::size_t>(n);
+      }
+      result.resize(size);
+    }
+    close(fd);
+
+    while (result.size() > beg && result.back() == '\n')
+      result.pop_back();
+    saved_buffer.swap(expansion_buffer);
+    result.swap(out);
+    return 0;
+  }
+}// namespace dish::interpreter
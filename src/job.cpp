@@ -14,127 +14,730 @@
 
 #include "dish/job.hpp"
 #include "dish/builtin.hpp"
+#include "dish/interpreter.hpp"
 #include "dish/utils.hpp"
+#include "dish/variable.hpp"
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <list>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <variant>
 #include <vector>
 
+// posix_spawn can only give the child the terminal since glibc 2.35
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define DISH_SPAWN_TCSETPGRP 1
+#else
+#define DISH_SPAWN_TCSETPGRP 0
+#endif
+
 namespace dish::job
 {
+  JobTable job_table;
+  std::shared_ptr<const Job> last_job;
+  int stdout_capture = -1;
+
+  ProcessStats to_stats(const struct rusage &usage)
+  {
+    auto seconds = [](const struct timeval &tv) { return static_cast<double>(tv.tv_sec) + tv.tv_usec / 1e6; };
+    ProcessStats ret;
+    ret.user = seconds(usage.ru_utime);
+    ret.sys = seconds(usage.ru_stime);
+    ret.max_rss = usage.ru_maxrss;
+    ret.minor_faults = usage.ru_minflt;
+    ret.major_faults = usage.ru_majflt;
+    ret.voluntary_switches = usage.ru_nvcsw;
+    ret.involuntary_switches = usage.ru_nivcsw;
+    return ret;
+  }
+
+  void ProcessStats::add(const ProcessStats &other)
+  {
+    real += other.real;
+    user += other.user;
+    sys += other.sys;
+    max_rss = (std::max)(max_rss, other.max_rss);
+    minor_faults += other.minor_faults;
+    major_faults += other.major_faults;
+    voluntary_switches += other.voluntary_switches;
+    involuntary_switches += other.involuntary_switches;
+  }
+
   //Redirect
+  RedirectType Redirect::get_type() const { return type; }
+
+  int Redirect::get_target() const { return target; }
+
   bool Redirect::is_description() const { return redirect.index() == 0; }
 
-  String Redirect::get_filename() const { return std::get<String>(redirect); }
+  const String &Redirect::get_filename() const { return std::get<String>(redirect); }
 
   int Redirect::get_description() const { return std::get<int>(redirect); }
 
+  int Redirect::get_flags() const
+  {
+    switch (type)
+    {
+      case RedirectType::input:
+        return O_RDONLY;
+      case RedirectType::overwrite:
+        return O_CREAT | O_TRUNC | O_WRONLY;
+      case RedirectType::append:
+        return O_CREAT | O_APPEND | O_WRONLY;
+      case RedirectType::read_write:
+        return O_CREAT | O_RDWR;
+      default:
+        return 0;
+    }
+  }
+
+  int write_all(int fd, std::string_view data)
+  {
+    for (std::size_t done = 0; done < data.size();)
+    {
+      auto n = write(fd, data.data() + done, data.size() - done);
+      if (n == -1 && errno == EINTR) continue;
+      if (n == -1) return -1;
+      done += n;
+    }
+    return 0;
+  }
+
+  // Small bodies fit in the buffer of a pipe. Larger ones are written to a memfd, so writing
+  // never waits for the command to read and nothing is left on disk.
+  int open_here(const String &content)
+  {
+    std::string_view data{content.data(), content.size()};
+    if (content.size() <= PIPE_BUF)
+    {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) == -1)
+        return -1;
+      int ret = write_all(fds[1], data);
+      close(fds[1]);
+      if (ret == -1)
+      {
+        close(fds[0]);
+        return -1;
+      }
+      return fds[0];
+    }
+    int fd = memfd_create("dish-here-document", MFD_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    if (write_all(fd, data) == -1 || lseek(fd, 0, SEEK_SET) == -1)
+    {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
   int Redirect::get() const
   {
     switch (type)
     {
       case RedirectType::input:
-        return open(get_filename().c_str(), O_RDONLY, S_IRUSR | S_IWUSR);
-        break;
       case RedirectType::overwrite:
-        return open(get_filename().c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
-        break;
       case RedirectType::append:
-        return open(get_filename().c_str(), O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
+      case RedirectType::read_write:
+        return open(std::get<String>(redirect).c_str(), get_flags() | O_CLOEXEC, S_IRUSR | S_IWUSR);
         break;
       case RedirectType::fd:
-        return dup(get_description());
+        return fcntl(get_description(), F_DUPFD_CLOEXEC, 0);
+        break;
+      case RedirectType::here:
+        return open_here(std::get<String>(redirect));
+        break;
+      case RedirectType::close:
         break;
     }
     return -1;
   }
 
+  int Process::apply_fds(int fdin, int fdout, const std::vector<int> &here_fds,
+                         std::vector<std::pair<int, int>> *saved) const
+  {
+    auto save = [saved](int fd) {
+      if (saved == nullptr)
+        return;
+      for (auto &r: *saved)
+      {
+        if (r.first == fd)
+          return;
+      }
+      // -1 if fd is not open, it is closed again by restore_fds
+      saved->emplace_back(fd, fcntl(fd, F_DUPFD_CLOEXEC, 10));
+    };
+    if (fdin != -1)
+    {
+      save(0);
+      dup2(fdin, 0);
+    }
+    if (fdout != -1)
+    {
+      save(1);
+      dup2(fdout, 1);
+    }
+    for (std::size_t i = 0; i < redirects.size(); ++i)
+    {
+      auto &r = redirects[i];
+      int target = r.get_target();
+      save(target);
+      int fd;
+      if (r.get_type() == RedirectType::close)
+      {
+        close(target);
+        continue;
+      }
+      else if (r.get_type() == RedirectType::fd)
+      {
+        if (dup2(r.get_description(), target) == -1)
+        {
+          fmt::println(stderr, "dish: {}: {}", r.get_description(), strerror(errno));
+          return -1;
+        }
+        continue;
+      }
+      else if (r.get_type() == RedirectType::here)
+        fd = here_fds[i];
+      else if ((fd = r.get()) == -1)
+      {
+        fmt::println(stderr, "dish: {}: {}", r.get_filename(), strerror(errno));
+        return -1;
+      }
+      if (fd == target)
+        fcntl(fd, F_SETFD, 0);
+      else
+      {
+        dup2(fd, target);
+        if (r.get_type() != RedirectType::here)
+          close(fd);
+      }
+    }
+    return 0;
+  }
+
+  void restore_fds(std::vector<std::pair<int, int>> &saved)
+  {
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+    {
+      if (it->second == -1)
+        close(it->first);
+      else
+      {
+        dup2(it->second, it->first);
+        close(it->second);
+      }
+    }
+    saved.clear();
+  }
+
   void Process::set_job_context(Job *job_)
   {
     job_context = job_;
   }
 
-  void Process::launch()
+  // A forked dish does not exec, so the fds that an exec would close are closed by it, e.g. the
+  // read end of the pipe it writes to, which would keep it from getting EPIPE.
+  void close_cloexec_fds()
   {
-    int childpid = 0;
-    if (type == ProcessType::builtin)
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == nullptr)
+      return;
+    std::vector<int> fds;
+    while (auto entry = readdir(dir))
     {
-      dish_context.lua_state["dish"]["last_foreground_ret"] = builtin::builtins.at(args[0])(args);
-      completed = true;
-      do_job_notification();
+      int fd = std::atoi(entry->d_name);
+      if (fd > 2 && fd != dirfd(dir) && (fcntl(fd, F_GETFD) & FD_CLOEXEC))
+        fds.emplace_back(fd);
+    }
+    closedir(dir);
+    for (auto fd: fds)
+      close(fd);
+  }
+
+  // The arguments are passed as strings. The results are written to stdout like print does,
+  // nothing is written if there is none.
+  int call_lua_function(const lua::FunctionTable::Function &function, const std::vector<String> &args)
+  {
+    auto &lua = dish_context.lua_state;
+    auto call = [&]() {
+      if (function.argv)
+      {
+        auto argv = lua.create_table(static_cast<int>(args.size() - 1), 0);
+        for (std::size_t i = 1; i < args.size(); ++i)
+          argv[i] = args[i].cpp_str();
+        return function.function(argv);
+      }
+      std::vector<std::string_view> views;
+      views.reserve(args.size() - 1);
+      for (std::size_t i = 1; i < args.size(); ++i)
+        views.emplace_back(args[i].data(), args[i].size());
+      return function.function(sol::as_args(views));
+    };
+    auto result = call();
+    if (!result.valid())
+    {
+      sol::error err = result;
+      fmt::println(stderr, "Dish Lua Error:\n{}", err.what());
+      return 1;
+    }
+    if (result.return_count() == 0)
+      return 0;
+    std::string output;
+    lua_State *L = lua.lua_state();
+    for (int i = 0; i < result.return_count(); ++i)
+    {
+      std::size_t size;
+      const char *str = luaL_tolstring(L, result.stack_index() + i, &size);
+      if (i != 0)
+        output += '\t';
+      output.append(str, size);
+      lua_pop(L, 1);
+    }
+    output += '\n';
+    // after what the function has printed itself
+    std::fflush(stdout);
+    write_all(STDOUT_FILENO, output);
+    return 0;
+  }
+
+  void Process::run_in_dish()
+  {
+    if (type == ProcessType::function)
+    {
+      // Keep the function alive even if it redefines itself.
+      auto function = interpreter::functions.at(args[0].cpp_str());
+      exit_status = interpreter::call_function(*function, args);
+    }
+    else if (type == ProcessType::builtin)
+    {
+      int ret = builtin::builtins.at(args[0])(args);
+      // builtins return -1 on failure
+      exit_status = ret < 0 ? 1 : ret;
     }
+    else if (type == ProcessType::native)
+      exit_status = builtin::natives.at(args[0])(args);
     else if (type == ProcessType::lua_func)
     {
-      String s;
-      for (size_t i = 1; i < args.size(); ++i)
+      // a copy, the function may redefine itself
+      auto function = *dish_context.lua_functions.find(args[0].cpp_str());
+      exit_status = call_lua_function(function, args);
+    }
+  }
+
+  void Process::launch(int fdin, int fdout)
+  {
+    int childpid = 0;
+    launch_time = std::chrono::steady_clock::now();
+    bool in_dish = type == ProcessType::function || type == ProcessType::builtin || type == ProcessType::native ||
+                   type == ProcessType::lua_func;
+    // Here-documents are written by dish, the child only gets the fd to read.
+    std::vector<int> here_fds(redirects.size(), -1);
+    bool here_failed = false;
+    for (std::size_t i = 0; i < redirects.size() && !here_failed; ++i)
+    {
+      if (redirects[i].get_type() == RedirectType::here && (here_fds[i] = redirects[i].get()) == -1)
       {
-        s += '"';
-        s += args[i];
-        s += '"';
-        if (i + 1 < args.size())
-          s += ", ";
+        fmt::println(stderr, "dish: here-document: {}", strerror(errno));
+        here_failed = true;
       }
-      String script = fmt::format("print(dish.func.{}({}))", args[0], s);
-      dish_context.lua_state.script(script.cpp_str(), &lua::dish_sol_error_handler);
+    }
+
+    if (here_failed)
+    {
+      exit_status = 1;
       completed = true;
-      do_job_notification();
     }
-    else if (type == ProcessType::executable)
+    // Only the last stage of a pipeline runs in dish itself, since it may change dish, e.g. cd.
+    // The others run in a forked dish and stream into the next stage, instead of filling the
+    // pipe before the next stage starts.
+    else if (in_dish && this != &job_context->processes.back())
     {
+      std::fflush(stdout);
       childpid = fork();
       if (childpid == 0)
       {
-        if (dish_context.is_interactive)
-        {
-          pid_t pid = getpid();
-          if (job_context->cmd_pgid == 0)
-            job_context->cmd_pgid = pid;
-          setpgid(pid, job_context->cmd_pgid);
-          if (!job_context->background)
-            tcsetpgrp(dish_context.terminal, job_context->cmd_pgid);
-
-          signal(SIGINT, SIG_DFL);
-          signal(SIGQUIT, SIG_DFL);
-          signal(SIGTSTP, SIG_DFL);
-          signal(SIGTTIN, SIG_DFL);
-          signal(SIGTTOU, SIG_DFL);
-          signal(SIGCHLD, SIG_DFL);
-        }
-        auto cargs = get_args();
-        execv(cmd_path.c_str(), cargs.data());
-        fmt::println(stderr, "execv: {}", strerror(errno));
-        std::exit(1);
+        enter_job();
+        if (apply_fds(fdin, fdout, here_fds, nullptr) == -1)
+          std::_Exit(1);
+        stdout_capture = -1;
+        close_cloexec_fds();
+        dish_context.is_interactive = false;
+        run_in_dish();
+        std::fflush(stdout);
+        std::_Exit(exit_status);
       }
+    }
+    else if (in_dish)
+    {
+      if (job_context->explicit_options)
+        fmt::println(stderr, "on: {} runs in dish, it is not placed or limited.", args[0]);
+      // the fds of dish itself, restored after the command
+      std::vector<std::pair<int, int>> saved;
+      struct rusage before, after;
+      getrusage(RUSAGE_SELF, &before);
+      std::fflush(stdout);
+      int capture = stdout_capture;
+      stdout_capture = -1;
+      if (apply_fds(fdin, fdout, here_fds, &saved) == -1)
+        exit_status = 1;
       else
+        run_in_dish();
+      std::fflush(stdout);
+      restore_fds(saved);
+      stdout_capture = capture;
+      // what dish used meanwhile, max_rss is the one of dish
+      getrusage(RUSAGE_SELF, &after);
+      auto used = to_stats(after);
+      auto base = to_stats(before);
+      stats = ProcessStats{std::chrono::duration<double>(std::chrono::steady_clock::now() - launch_time).count(),
+                           used.user - base.user, used.sys - base.sys, used.max_rss,
+                           used.minor_faults - base.minor_faults, used.major_faults - base.major_faults,
+                           used.voluntary_switches - base.voluntary_switches,
+                           used.involuntary_switches - base.involuntary_switches};
+      dish_context.lua_state["dish"]["last_foreground_ret"] = exit_status;
+      completed = true;
+      do_job_notification();
+    }
+    else if (type == ProcessType::executable)
+    {
+      // built before forking, the variables of dish are the environment of the command
+      auto envp = variable::variable_table.get_envp();
+      childpid = spawn(fdin, fdout, here_fds, envp);
+      if (childpid == -1)
       {
-        pid = childpid;
-        if (dish_context.is_interactive)
+        childpid = fork();
+        if (childpid == 0)
         {
-          if (job_context->cmd_pgid == 0)
-            job_context->cmd_pgid = childpid;
-          setpgid(childpid, job_context->cmd_pgid);
+          enter_job();
+          if (apply_fds(fdin, fdout, here_fds, nullptr) == -1)
+            std::_Exit(1);
+          auto cargs = get_args();
+          execve(cmd_path.c_str(), cargs.data(), envp);
+          fmt::println(stderr, "execve: {}", strerror(errno));
+          std::exit(1);
         }
       }
     }
+    else if (type == ProcessType::substitution)
+    {
+      // buffered output would be written by both
+      std::fflush(stdout);
+      childpid = fork();
+      if (childpid == 0)
+      {
+        enter_job();
+        dup2(pipe_fd, target_fd);
+        // the output of >(...) is part of the command substitution it is in
+        if (stdout_capture != -1 && target_fd == 0)
+          dup2(stdout_capture, 1);
+        stdout_capture = -1;
+        for (auto fd: job_context->substitution_fds)
+          close(fd);
+        close_cloexec_fds();
+        // a subshell, its jobs are waited without job control
+        dish_context.is_interactive = false;
+        int ret = interpreter::execute(*program);
+        std::fflush(stdout);
+        std::_Exit(ret);
+      }
+      close(pipe_fd);
+      job_context->substitution_fds.erase(
+              std::find(job_context->substitution_fds.begin(), job_context->substitution_fds.end(), pipe_fd));
+      pipe_fd = -1;
+    }
     else
       fmt::println(stderr, "Unknown process.");
+
+    if (fdin != -1)
+      close(fdin);
+    if (fdout != -1)
+      close(fdout);
+    for (auto fd: here_fds)
+    {
+      if (fd != -1)
+        close(fd);
+    }
+    if (childpid == -1)
+    {
+      fmt::println(stderr, "fork: {}", strerror(errno));
+      exit_status = 1;
+      completed = true;
+    }
+    else if (childpid != 0)
+    {
+      pid = childpid;
+      job_table.add_process(this);
+      if (dish_context.is_interactive)
+      {
+        if (job_context->cmd_pgid == 0)
+          job_context->cmd_pgid = childpid;
+        setpgid(childpid, job_context->cmd_pgid);
+      }
+    }
+  }
+
+  int Process::spawn(int fdin, int fdout, const std::vector<int> &here_fds, char *const *envp)
+  {
+    // posix_spawn can not set the affinity, nice, I/O priority, cgroup and rlimits
+    if (!job_context->placement.empty() || !job_context->limits.empty())
+      return -1;
+#if !DISH_SPAWN_TCSETPGRP
+    // the child has to take the terminal itself
+    if (dish_context.is_interactive && !job_context->background)
+      return -1;
+#endif
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    // what enter_job() does after fork
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    if (dish_context.is_interactive)
+    {
+      flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+      posix_spawnattr_setpgroup(&attr, job_context->cmd_pgid);
+      for (auto sig: {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD})
+        sigaddset(&signals, sig);
+      posix_spawnattr_setsigdefault(&attr, &signals);
+#if DISH_SPAWN_TCSETPGRP
+      if (!job_context->background)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, dish_context.terminal);
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    // what apply_fds() does after fork
+    if (fdin != -1)
+      posix_spawn_file_actions_adddup2(&actions, fdin, 0);
+    if (fdout != -1)
+      posix_spawn_file_actions_adddup2(&actions, fdout, 1);
+    for (std::size_t i = 0; i < redirects.size(); ++i)
+    {
+      auto &r = redirects[i];
+      switch (r.get_type())
+      {
+        case RedirectType::close:
+          posix_spawn_file_actions_addclose(&actions, r.get_target());
+          break;
+        case RedirectType::fd:
+          posix_spawn_file_actions_adddup2(&actions, r.get_description(), r.get_target());
+          break;
+        case RedirectType::here:
+          posix_spawn_file_actions_adddup2(&actions, here_fds[i], r.get_target());
+          break;
+        default:
+          posix_spawn_file_actions_addopen(&actions, r.get_target(), r.get_filename().c_str(), r.get_flags(),
+                                           S_IRUSR | S_IWUSR);
+          break;
+      }
+    }
+
+    auto cargs = get_args();
+    pid_t child;
+    int err = posix_spawn(&child, cmd_path.c_str(), &actions, &attr, cargs.data(), envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    // posix_spawn does not tell which redirect failed, the forked child does.
+    if (err != 0 && !redirects.empty())
+      return -1;
+    if (err != 0)
+    {
+      fmt::println(stderr, "dish: {}: {}", args[0], strerror(err));
+      exit_status = err == ENOENT ? 127 : 126;
+      completed = true;
+      return 0;
+    }
+    return child;
   }
 
+  // linux/ioprio.h, which glibc does not wrap
+  constexpr int ioprio_who_process = 1;
+  constexpr int ioprio_class_shift = 13;
+
+  bool Placement::empty() const
+  {
+    return cpus.empty() && !has_nice && io_class == 0;
+  }
+
+  int parse_int(std::string_view str, int &value)
+  {
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc{} && end == str.data() + str.size() ? 0 : -1;
+  }
+
+  int set_placement_option(Placement &placement, std::string_view key, std::string_view value)
+  {
+    if (key == "cpus")
+    {
+      std::vector<int> cpus;
+      while (!value.empty())
+      {
+        auto item = value.substr(0, value.find(','));
+        value.remove_prefix(std::min(value.size(), item.size() + 1));
+        int first, last;
+        auto dash = item.find('-');
+        if (parse_int(item.substr(0, dash), first) == -1 ||
+            parse_int(dash == std::string_view::npos ? item : item.substr(dash + 1), last) == -1 ||
+            first < 0 || first > last || last >= CPU_SETSIZE)
+          return -1;
+        for (int cpu = first; cpu <= last; ++cpu)
+          cpus.emplace_back(cpu);
+      }
+      if (cpus.empty())
+        return -1;
+      placement.cpus = std::move(cpus);
+    }
+    else if (key == "nice")
+    {
+      int nice;
+      if (parse_int(value, nice) == -1 || nice < -20 || nice > 19)
+        return -1;
+      placement.nice = nice;
+      placement.has_nice = true;
+    }
+    else if (key == "io")
+    {
+      // idle, best-effort[:level], realtime[:level] or default
+      auto colon = value.find(':');
+      auto name = value.substr(0, colon);
+      int level = 4;
+      if (colon != std::string_view::npos && (parse_int(value.substr(colon + 1), level) == -1 || level < 0 || level > 7))
+        return -1;
+      if (name == "default" && colon == std::string_view::npos)
+        placement.io_class = 0;
+      else if (name == "realtime" || name == "rt")
+        placement.io_class = 1;
+      else if (name == "best-effort" || name == "be")
+        placement.io_class = 2;
+      else if (name == "idle" && colon == std::string_view::npos)
+      {
+        placement.io_class = 3;
+        level = 0;
+      }
+      else
+        return -1;
+      placement.io_level = level;
+    }
+    else if (key == "spread")
+    {
+      if (value != "true" && value != "false")
+        return -1;
+      placement.spread = value == "true";
+    }
+    else
+      return -1;
+    return 0;
+  }
+
+  // stage is the index of the process in the pipeline, -1 for a process substitution. A failure
+  // is reported and the command still runs.
+  void apply_placement(const Placement &placement, std::ptrdiff_t stage)
+  {
+    if (!placement.cpus.empty())
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      if (placement.spread && stage >= 0)
+        CPU_SET(placement.cpus[static_cast<std::size_t>(stage) % placement.cpus.size()], &set);
+      else
+      {
+        for (auto cpu: placement.cpus)
+          CPU_SET(cpu, &set);
+      }
+      if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        fmt::println(stderr, "on: cpus: {}", strerror(errno));
+    }
+    if (placement.has_nice && setpriority(PRIO_PROCESS, 0, placement.nice) == -1)
+      fmt::println(stderr, "on: nice: {}", strerror(errno));
+    if (placement.io_class != 0 &&
+        syscall(SYS_ioprio_set, ioprio_who_process, 0,
+                placement.io_class << ioprio_class_shift | placement.io_level) == -1)
+      fmt::println(stderr, "on: io: {}", strerror(errno));
+  }
+
+  void Process::enter_job() const
+  {
+    if (!job_context->placement.empty())
+      apply_placement(job_context->placement,
+                      this - job_context->processes.data() - static_cast<std::ptrdiff_t>(job_context->substitution_count));
+    if (job_context->leaf.is_created())
+    {
+      if (job_context->leaf.enter() == -1)
+        fmt::println(stderr, "dish: cgroup: {}", strerror(errno));
+    }
+    else if (!job_context->limits.empty())
+      cgroup::apply_rlimits(job_context->limits);
+    if (dish_context.is_interactive)
+    {
+      pid_t pid = getpid();
+      if (job_context->cmd_pgid == 0)
+        job_context->cmd_pgid = pid;
+      setpgid(pid, job_context->cmd_pgid);
+      if (!job_context->background)
+        tcsetpgrp(dish_context.terminal, job_context->cmd_pgid);
+
+      signal(SIGINT, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+    }
+  }
+
+
   void Process::insert(String str)
   {
     args.emplace_back(std::move(str));
   }
 
+  String Process::get_command() const
+  {
+    if (type == ProcessType::substitution)
+      return "(process substitution)";
+    String ret;
+    for (auto &r: args)
+    {
+      if (!ret.empty())
+        ret += " ";
+      ret += r;
+    }
+    return ret;
+  }
+
+  void Process::insert_redirect(Redirect redirect)
+  {
+    redirects.emplace_back(std::move(redirect));
+  }
+
   bool Process::empty() const
   {
     return args.empty();
@@ -154,20 +757,66 @@ namespace dish::job
     return cargs;
   }
 
+  int Process::stat_stdout(struct stat &st) const
+  {
+    // The last redirection of the fd decides, n>&m follows m to the redirections before.
+    int fd = STDOUT_FILENO;
+    for (auto it = redirects.rbegin(); it != redirects.rend(); ++it)
+    {
+      if (it->get_target() != fd)
+        continue;
+      switch (it->get_type())
+      {
+        case RedirectType::overwrite:
+        case RedirectType::append:
+        case RedirectType::read_write:
+          if (stat(it->get_filename().c_str(), &st) == 0)
+            return 0;
+          // a file that does not exist yet is created
+          st = {};
+          st.st_mode = S_IFREG;
+          return errno == ENOENT ? 0 : -1;
+        case RedirectType::fd:
+          fd = it->get_description();
+          break;
+        default:
+          return -1;
+      }
+    }
+    return fstat(fd, &st);
+  }
+
   int Process::find_cmd()
   {
     if (args.empty() || args[0].empty())
+    {
+      exit_status = 0;
+      completed = true;
       return -1;
-    auto [cmd_type, cmd] = utils::find_command(args[0]);
+    }
+    // A native command that is not the last stage would be forked, which is no cheaper than
+    // the executable.
+    bool last = this == &job_context->processes.back();
+    struct stat out;
+    bool native = last && builtin::native_supports(args, stat_stdout(out) == 0 ? &out : nullptr);
+    auto [cmd_type, cmd] = utils::find_command(args[0], native);
     switch (cmd_type)
     {
       case utils::CommandType::not_found:
         fmt::println(stderr, "dish: command not found: {}", args[0]);
+        exit_status = 127;
+        completed = true;
         return -1;
         break;
+      case utils::CommandType::function:
+        type = ProcessType::function;
+        break;
       case utils::CommandType::builtin:
         type = ProcessType::builtin;
         break;
+      case utils::CommandType::native:
+        type = ProcessType::native;
+        break;
       case utils::CommandType::lua_func:
         type = ProcessType::lua_func;
         break;
@@ -178,6 +827,8 @@ namespace dish::job
         break;
       case utils::CommandType::not_executable:
         fmt::println(stderr, "dish: permission denied: {}", args[0]);
+        exit_status = 126;
+        completed = true;
         return -1;
         break;
     }
@@ -185,123 +836,86 @@ namespace dish::job
   }
 
   Job::Job(String cmd)
-      : out(RedirectType::fd, 0), in(RedirectType::fd, 1),
-        err(RedirectType::fd, 2), background(false), command_str(std::move(cmd)),
-        notified(false), cmd_pgid(0)
+      : command_str(std::move(cmd)), cmd_pgid(0), background(false), substitution_count(0),
+        pipe_size(default_pipe_size), explicit_options(false), has_usage(false), notified(false), id(0)
   {
     tcgetattr(dish_context.terminal, &job_tmodes);
   }
 
   int Job::launch()
   {
-    for (auto &r: processes)
+    if (stdout_capture != -1 && !processes.empty())
     {
-      if (r.find_cmd() != 0)
-        return -1;
+      auto &redirects = processes.back().redirects;
+      redirects.insert(redirects.begin(), Redirect{RedirectType::fd, 1, stdout_capture});
     }
-    int tmpin = dup(0);
-    int tmpout = dup(1);
-    int fdin = 0;
-    int fdout = 0;
-    if (!in.is_description() || in.get_description() != 1)
+    for (auto &r: processes)
     {
-      fdin = in.get();
-      if (fdin == -1)
-      {
-        fmt::println(stderr, "open/dup: {}", strerror(errno));
+      // The job may have been copied or moved since the processes were inserted.
+      r.set_job_context(this);
+      if (r.type != ProcessType::substitution && r.find_cmd() != 0)
         return -1;
-      }
     }
-    else
+    // Without a leaf, the children set the limits that have an rlimit.
+    if (!limits.empty() && leaf.create(limits) == -1)
     {
-      fdin = dup(tmpin);
-      if (fdin == -1)
-      {
-        fmt::println(stderr, "dup: {}", strerror(errno));
-        return -1;
-      }
+      if (limits.cpu_quota != 0)
+        fmt::println(stderr, "dish: cpu= needs a writable cgroup v2 subtree, it is ignored.");
+      if (limits.pids != 0)
+        fmt::println(stderr, "dish: pids= needs a writable cgroup v2 subtree, it is ignored.");
     }
-
-    for (auto it = processes.begin(); it < processes.end(); ++it)
+    // They run concurrently with the pipeline, their ends of the pipes are not redirected.
+    auto pipeline_begin = processes.begin() + static_cast<std::ptrdiff_t>(substitution_count);
+    for (auto it = processes.begin(); it < pipeline_begin; ++it)
+      it->launch(-1, -1);
+    // Each process gets its ends of the pipes as fds, which it closes. They are close-on-exec,
+    // so a command only inherits its own. The first and the last process keep the stdin and
+    // stdout of dish.
+    int fdin = -1;
+    for (auto it = pipeline_begin; it < processes.end(); ++it)
     {
-      auto &scmd = *it;
-      dup2(fdin, 0);
-      close(fdin);
-      if (it + 1 == processes.cend())
-      {
-        if (!out.is_description() || out.get_description() != 0)
-        {
-          fdout = out.get();
-          if (fdout == -1)
-          {
-            fmt::println(stderr, "open/dup: {}", strerror(errno));
-            return -1;
-          }
-        }
-        else
-        {
-          fdout = dup(tmpout);
-          if (fdout == -1)
-          {
-            fmt::println(stderr, "dup: {}", strerror(errno));
-            return -1;
-          }
-        }
-      }
-      else
+      int fdout = -1;
+      int next_fdin = -1;
+      if (it + 1 != processes.cend())
       {
         int fdpipe[2];
-        if (pipe(fdpipe) == -1)
+        if (pipe2(fdpipe, O_CLOEXEC) == -1)
         {
           fmt::println(stderr, "pipe: {}", strerror(errno));
+          if (fdin != -1)
+            close(fdin);
+          release_leaf();
           return -1;
         }
         fdout = fdpipe[1];
-        fdin = fdpipe[0];
-      }
-      if (dup2(fdout, 1) == -1)
-      {
-        fmt::println(stderr, "dup2: {}", strerror(errno));
-        return -1;
-      }
-      if (close(fdout) == -1)
-      {
-        fmt::println(stderr, "close: {}", strerror(errno));
-        return -1;
+        next_fdin = fdpipe[0];
+        // A failure, e.g. EPERM beyond the pipe buffer limit of the user, keeps the default.
+        if (pipe_size > 0)
+          fcntl(fdout, F_SETPIPE_SZ, std::min(pipe_size, max_pipe_size()));
+        else if (pipe_size == adaptive_pipe_size)
+          pipes.emplace_back(PipeState{static_cast<std::size_t>(it + 1 - processes.begin()), 0, 0});
       }
-      scmd.launch();
+      it->launch(fdin, fdout);
+      fdin = next_fdin;
     }
+    // The commands have their copies, or a reader would never see the end of its input.
+    close_substitution_fds();
+    // e.g. all the commands ran in dish
+    if (is_completed())
+      release_leaf();
 
-    if (dup2(tmpin, 0) == -1)
-    {
-      fmt::println(stderr, "dup2: {}", strerror(errno));
-      return -1;
-    }
-    if (dup2(tmpout, 1) == -1)
+    job_table.mark_changed(id);
+    // A script only waits for its foreground jobs, there is no terminal to give them.
+    if (background)
     {
-      fmt::println(stderr, "dup2: {}", strerror(errno));
-      return -1;
-    }
-
-    if (close(tmpin) == -1)
-    {
-      fmt::println(stderr, "close: {}", strerror(errno));
-      return -1;
-    }
-    if (close(tmpout) == -1)
-    {
-      fmt::println(stderr, "close: {}", strerror(errno));
-      return -1;
+      if (dish_context.is_interactive)
+        fmt::println(format_job_info("launched").cpp_str());
+      put_in_background(0);
     }
-    if (!dish_context.is_interactive)
-      wait();
-    else if (!background)
+    else if (dish_context.is_interactive)
       put_in_foreground(0);
     else
-    {
-      fmt::println(format_job_info("launched").cpp_str());
-      put_in_background(0);
-    }
+      wait();
     return 0;
   }
 
@@ -333,17 +947,62 @@ namespace dish::job
     }
   }
 
+  void Job::set_pipe_size(int size)
+  {
+    pipe_size = size;
+  }
+
+  void Job::set_placement(Placement placement_)
+  {
+    placement = std::move(placement_);
+  }
+
+  void Job::set_limits(cgroup::Limits limits_)
+  {
+    limits = limits_;
+  }
+
+  void Job::set_explicit_options()
+  {
+    explicit_options = true;
+  }
+
   void Job::insert(const Process &scmd)
   {
     processes.emplace_back(std::move(scmd));
     processes.back().set_job_context(this);
   }
 
-  void Job::set_in(Redirect redirect) { in = std::move(redirect); }
+  String Job::insert_substitution(std::shared_ptr<const interpreter::Program> program, bool input)
+  {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+      fmt::println(stderr, "pipe: {}", strerror(errno));
+      return "";
+    }
+    // The end of the command is inherited through exec, so /dev/fd/N is valid in it.
+    int command_fd = input ? fds[0] : fds[1];
+    fcntl(command_fd, F_SETFD, 0);
+    substitution_fds.emplace_back(fds[0]);
+    substitution_fds.emplace_back(fds[1]);
 
-  void Job::set_out(Redirect redirect) { out = std::move(redirect); }
+    Process scmd;
+    scmd.type = ProcessType::substitution;
+    scmd.program = std::move(program);
+    scmd.pipe_fd = input ? fds[1] : fds[0];
+    scmd.target_fd = input ? 1 : 0;
+    scmd.set_job_context(this);
+    processes.insert(processes.begin() + static_cast<std::ptrdiff_t>(substitution_count++), std::move(scmd));
+    return fmt::format("/dev/fd/{}", command_fd);
+  }
 
-  void Job::set_err(Redirect redirect) { err = std::move(redirect); }
+  void Job::close_substitution_fds()
+  {
+    for (auto fd: substitution_fds)
+      close(fd);
+    substitution_fds.clear();
+  }
 
   void Job::set_background()
   {
@@ -380,82 +1039,263 @@ namespace dish::job
     return true;
   }
 
-  bool Job::is_builtin_or_lua()
+  int Job::get_exit_status() const
   {
     for (auto &p: processes)
     {
-      if (p.type != ProcessType::builtin && p.type != ProcessType::lua_func)
-        return false;
+      if (p.type == ProcessType::unknown && p.completed)
+        return p.exit_status;
     }
-    return true;
+    if (processes.empty())
+      return 0;
+    auto &p = processes.back();
+    if (p.stopped)
+      return 128 + WSTOPSIG(p.status);
+    if (p.exit_status != -1)
+      return p.exit_status;
+    if (p.completed && WIFSIGNALED(p.status))
+      return 128 + WTERMSIG(p.status);
+    return 0;
   }
 
-  int Job::mark_status(int pid, int status)
+  void Process::mark_status(int status_, const struct rusage &usage)
   {
-    if (pid > 0)
+    status = status_;
+    if (WIFSTOPPED(status))
+      stopped = true;
+    else
     {
-      for (auto &p: processes)
+      completed = true;
+      stats = to_stats(usage);
+      stats.real = std::chrono::duration<double>(std::chrono::steady_clock::now() - launch_time).count();
+      // SIGPIPE is how a stage of a pipeline normally ends, e.g. yes | head
+      if (WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE)
+        fmt::println(stderr, "{}: Terminated by signal {}.", pid, WTERMSIG(status));
+      else if (WIFEXITED(status))
+      {
+        exit_status = WEXITSTATUS(status);
+        if (!job_context->is_background())
+          dish_context.lua_state["dish"]["last_foreground_ret"] = exit_status;
+      }
+      if (job_context->is_completed())
+        job_context->release_leaf();
+    }
+  }
+
+  void Job::wait()
+  {
+    // An adaptive job is sampled every interval until a child changes state. SIGCHLD is blocked,
+    // so one that arrives between wait4 and sigtimedwait is not lost.
+    bool adaptive = !pipes.empty();
+    sigset_t chld_mask, old_mask;
+    if (adaptive)
+    {
+      sigemptyset(&chld_mask);
+      sigaddset(&chld_mask, SIGCHLD);
+      sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+    }
+    while (!is_stopped() && !is_completed())
+    {
+      int status;
+      struct rusage usage;
+      pid_t pid = wait4(-1, &status, adaptive ? WUNTRACED | WNOHANG : WUNTRACED, &usage);
+      if (pid == 0)
       {
-        if (p.pid == pid)
+        static constexpr timespec interval{0, 20'000'000};
+        if (sigtimedwait(&chld_mask, nullptr, &interval) == -1 && errno == EAGAIN)
+          sample_pipes();
+        continue;
+      }
+      if (pid == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        if (errno != ECHILD)
+          fmt::println(stderr, "wait4: {}", strerror(errno));
+        break;
+      }
+      // may be a child of another job, e.g. one in background
+      mark_process_status(pid, status, usage);
+    }
+    if (adaptive)
+      sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+    do_job_notification();
+  }
+
+  void Job::sample_pipes()
+  {
+    for (auto &pipe: pipes)
+    {
+      auto &reader = processes[pipe.reader];
+      if (reader.pid <= 0 || reader.completed || pipe.size >= max_pipe_size())
+        continue;
+      // Dish does not keep the ends of the pipes, the reader's stdin is opened for a moment.
+      // It is the pipe unless the command redirected its stdin, which is not a fifo then.
+      auto path = fmt::format("/proc/{}/fd/0", reader.pid);
+      int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1)
+        continue;
+      struct stat st;
+      int queued = 0;
+      int size = -1;
+      if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && ioctl(fd, FIONREAD, &queued) == 0)
+        size = fcntl(fd, F_GETPIPE_SZ);
+      if (size > 0)
+      {
+        pipe.size = size;
+        // the reader does not keep up, a larger buffer saves the writer from blocking
+        if (queued >= size / 4 * 3)
         {
-          p.status = status;
-          if (WIFSTOPPED(status))
-            p.stopped = true;
-          else
+          if (++pipe.full_samples >= 2)
           {
-            p.completed = true;
-            if (WIFSIGNALED(status))
-              fmt::println(stderr, "{}: Terminated by signal {}.", pid, WTERMSIG(p.status));
-            else if (WIFEXITED(status))
-            {
-              auto es = WEXITSTATUS(status);
-              p.exit_status = es;
-              if (!is_background())
-                dish_context.lua_state["dish"]["last_foreground_ret"] = es;
-            }
+            int grown = fcntl(fd, F_SETPIPE_SZ, std::min(size * 4, max_pipe_size()));
+            // kept at the size if the user is out of pipe buffers
+            pipe.size = grown > 0 ? grown : max_pipe_size();
+            pipe.full_samples = 0;
           }
-          return 0;
         }
+        else
+          pipe.full_samples = 0;
       }
+      close(fd);
+    }
+  }
+
+  int parse_pipe_size(std::string_view text)
+  {
+    if (text == "default")
+      return default_pipe_size;
+    if (text == "adaptive")
+      return adaptive_pipe_size;
+    long long size = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), size);
+    if (ec != std::errc{} || size <= 0)
+      return -2;
+    std::string_view unit{end, static_cast<std::size_t>(text.data() + text.size() - end)};
+    if (unit == "K" || unit == "k")
+      size <<= 10;
+    else if (unit == "M" || unit == "m")
+      size <<= 20;
+    else if (!unit.empty())
+      return -2;
+    if (size > INT_MAX)
+      return -2;
+    return static_cast<int>(size);
+  }
+
+  int max_pipe_size()
+  {
+    static const int size = []
+    {
+      int ret = 1 << 20;
+      std::ifstream fs("/proc/sys/fs/pipe-max-size");
+      if (!(fs >> ret) || ret <= 0)
+        ret = 1 << 20;
+      return ret;
+    }();
+    return size;
+  }
+
+  int mark_process_status(pid_t pid, int status, const struct rusage &usage)
+  {
+    if (job_table.mark_status(pid, status, usage) == -1)
+    {
       fmt::println(stderr, "mark_status: No such child process {}.", pid);
       return -1;
     }
-    else if (pid == 0 || errno == ECHILD)
-      return -1;
-    fmt::println(stderr, "waitpid: {}", strerror(errno));
-    return -1;
+    return 0;
   }
 
-  void Job::wait()
+  bool reap_children()
   {
-    if (!is_builtin_or_lua())
+    bool reaped = false;
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WUNTRACED | WNOHANG, &usage)) > 0)
     {
-      int status;
-      pid_t pid;
-      dish_context.waiting = true;
-      do
-        pid = waitpid(-1, &status, WUNTRACED);
-      while (!mark_status(pid, status) && !is_stopped() && !is_completed());
-      dish_context.waiting = false;
+      mark_process_status(pid, status, usage);
+      reaped = true;
     }
-    do_job_notification();
+    return reaped;
+  }
+
+  [[nodiscard]] String Job::format_job_info(const String &status)
+  {
+    auto info = fmt::format("[{}] {} [{}]: {}", id, cmd_pgid, status, command_str);
+    cgroup::Usage used;
+    if (!get_usage(used))
+      return info;
+    if (used.memory_peak >= 0)
+      info += fmt::format(" (memory peak {}, cpu {:.2f}s", utils::get_human_readable_size(static_cast<std::size_t>(used.memory_peak)), used.cpu);
+    else
+      info += fmt::format(" (cpu {:.2f}s", used.cpu);
+    if (used.throttled > 0)
+      info += fmt::format(", throttled {:.2f}s", used.throttled);
+    if (used.oom_kills > 0)
+      info += fmt::format(", {} killed by oom", used.oom_kills);
+    return info + ")";
+  }
+
+  bool Job::get_usage(cgroup::Usage &ret) const
+  {
+    if (leaf.is_created())
+      ret = leaf.read();
+    else if (has_usage)
+      ret = usage;
+    else
+      return false;
+    return true;
+  }
+
+  void Job::release_leaf()
+  {
+    if (!leaf.is_created())
+      return;
+    usage = leaf.read();
+    has_usage = true;
+    leaf.remove();
   }
 
-  void Job::update_status()
+  ProcessStats Job::get_stats() const
   {
-    if (!is_builtin_or_lua())
+    ProcessStats ret;
+    std::chrono::steady_clock::time_point first{};
+    std::chrono::steady_clock::time_point last{};
+    for (auto &p: processes)
     {
-      int status;
-      pid_t pid;
-      do
-        pid = waitpid(-1, &status, WUNTRACED | WNOHANG);
-      while (!mark_status(pid, status) && !is_stopped() && !is_completed());
+      if (!p.completed || p.launch_time == std::chrono::steady_clock::time_point{})
+        continue;
+      ret.add(p.stats);
+      auto end = p.launch_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                         std::chrono::duration<double>(p.stats.real));
+      if (first == std::chrono::steady_clock::time_point{} || p.launch_time < first)
+        first = p.launch_time;
+      last = (std::max)(last, end);
     }
+    ret.real = std::chrono::duration<double>(last - first).count();
+    return ret;
   }
 
-  [[nodiscard]] String Job::format_job_info(const String &status)
+  void Job::print_stats() const
   {
-    return fmt::format("{} [{}]: {}", cmd_pgid, status, command_str);
+    auto print = [](const ProcessStats &st, const String &name) {
+      fmt::println(stderr, "{:>9.3f}s {:>9.3f}s {:>9.3f}s {:>8} {:>12} {:>12}  {}", st.real, st.user, st.sys,
+                   utils::get_human_readable_size(static_cast<std::size_t>(st.max_rss) * 1024),
+                   fmt::format("{}/{}", st.minor_faults, st.major_faults),
+                   fmt::format("{}/{}", st.voluntary_switches, st.involuntary_switches), name);
+    };
+    fmt::println(stderr, "{:>10} {:>10} {:>10} {:>8} {:>12} {:>12}  {}", "real", "user", "sys", "max rss",
+                 "faults", "switches", "command");
+    if (processes.size() > 1)
+    {
+      for (auto &p: processes)
+      {
+        if (p.completed && p.launch_time != std::chrono::steady_clock::time_point{})
+          print(p.stats, p.get_command());
+      }
+    }
+    print(get_stats(), processes.size() > 1 ? String{"total"} : command_str);
   }
 
   void Job::continue_job()
@@ -468,4 +1308,106 @@ namespace dish::job
     else
       put_in_background(1);
   }
-}// namespace dish::job
\ No newline at end of file
+
+  int JobTable::insert(std::shared_ptr<Job> job)
+  {
+    slots.emplace_back(Slot{std::move(job), false});
+    ++count;
+    int id = static_cast<int>(slots.size());
+    slots.back().job->id = id;
+    return id;
+  }
+
+  void JobTable::erase(int id)
+  {
+    if (id < 1 || id > static_cast<int>(slots.size()) || slots[id - 1].job == nullptr)
+      return;
+    auto &job = slots[id - 1].job;
+    // a job that failed to launch may still have processes
+    for (auto &p: job->processes)
+    {
+      if (p.pid > 0 && !p.completed)
+        processes.erase(p.pid);
+    }
+    job->id = 0;
+    job = nullptr;
+    --count;
+    while (!slots.empty() && slots.back().job == nullptr)
+      slots.pop_back();
+  }
+
+  std::shared_ptr<Job> JobTable::find(int id) const
+  {
+    if (id < 1 || id > static_cast<int>(slots.size()))
+      return nullptr;
+    return slots[id - 1].job;
+  }
+
+  std::shared_ptr<Job> JobTable::current() const
+  {
+    for (auto it = slots.crbegin(); it != slots.crend(); ++it)
+    {
+      if (it->job != nullptr && (it->job->is_background() || it->job->is_stopped()))
+        return it->job;
+    }
+    return nullptr;
+  }
+
+  std::vector<std::shared_ptr<Job>> JobTable::list() const
+  {
+    std::vector<std::shared_ptr<Job>> ret;
+    ret.reserve(count);
+    for (auto &slot: slots)
+    {
+      if (slot.job != nullptr)
+        ret.emplace_back(slot.job);
+    }
+    return ret;
+  }
+
+  std::size_t JobTable::size() const
+  {
+    return count;
+  }
+
+  void JobTable::add_process(Process *process)
+  {
+    processes[process->pid] = process;
+  }
+
+  int JobTable::mark_status(pid_t pid, int status, const struct rusage &usage)
+  {
+    auto it = processes.find(pid);
+    if (it == processes.end())
+      return -1;
+    auto process = it->second;
+    process->mark_status(status, usage);
+    if (process->completed)
+      processes.erase(it);
+    mark_changed(process->job_context->id);
+    return 0;
+  }
+
+  void JobTable::mark_changed(int id)
+  {
+    if (id < 1 || id > static_cast<int>(slots.size()))
+      return;
+    auto &slot = slots[id - 1];
+    if (slot.job == nullptr || slot.changed)
+      return;
+    slot.changed = true;
+    changed.emplace_back(id);
+  }
+
+  std::vector<int> JobTable::take_changed()
+  {
+    std::vector<int> ret;
+    ret.swap(changed);
+    for (auto id: ret)
+    {
+      if (id <= static_cast<int>(slots.size()))
+        slots[id - 1].changed = false;
+    }
+    return ret;
+  }
+}// namespace dish::job
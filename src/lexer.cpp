@@ -15,8 +15,17 @@
 #include "dish/lexer.hpp"
 #include "dish/utils.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dish::lexer
@@ -35,6 +44,12 @@ namespace dish::lexer
           case TokenType::end:
             cmd_state = CmdState::end;
             break;
+          case TokenType::newline:
+          case TokenType::heredoc:
+            break;
+          case TokenType::dsemi:
+            cmd_state = CmdState::separator;
+            break;
           default:
             fmt::println(stderr, "Syntax Error: Unexpected '{}' at begin.\n{}", token.get_content(),
                          mark_error_from_token(token));
@@ -64,11 +79,24 @@ namespace dish::lexer
           case TokenType::pipe:
             cmd_state = CmdState::pipe;
             break;
+          case TokenType::and_and:
+          case TokenType::or_or:
+            cmd_state = CmdState::and_or;
+            break;
           case TokenType::end:
             cmd_state = CmdState::end;
             break;
           case TokenType::background:
-            cmd_state = CmdState::background;
+          case TokenType::semicolon:
+          case TokenType::dsemi:
+          case TokenType::rparen:
+            cmd_state = CmdState::separator;
+            break;
+          case TokenType::lparen:
+            cmd_state = CmdState::lparen;
+            break;
+          case TokenType::newline:
+            cmd_state = CmdState::init;
             break;
           default:
             fmt::println(stderr, "Syntax Error: Unexpected '{}' after a command.\n{}", token.get_content(),
@@ -95,6 +123,44 @@ namespace dish::lexer
             break;
         }
         break;
+      case CmdState::and_or:
+        switch (token.get_type())
+        {
+          case TokenType::word:
+          case TokenType::env_var:
+            cmd_state = CmdState::word_or_env;
+            break;
+          case TokenType::newline:
+          case TokenType::heredoc:
+            break;
+          case TokenType::end:
+            fmt::println(stderr, "Syntax Error: Unexpected end.");
+            return -1;
+            break;
+          default:
+            fmt::println(stderr, "Syntax Error: Unexpected '{}' after a list operator.\n{}", token.get_content(),
+                         mark_error_from_token(token));
+            return -1;
+            break;
+        }
+        break;
+      case CmdState::lparen:
+        switch (token.get_type())
+        {
+          case TokenType::rparen:
+            cmd_state = CmdState::separator;
+            break;
+          case TokenType::end:
+            fmt::println(stderr, "Syntax Error: Unexpected end.");
+            return -1;
+            break;
+          default:
+            fmt::println(stderr, "Syntax Error: Unexpected '{}' after '('.\n{}", token.get_content(),
+                         mark_error_from_token(token));
+            return -1;
+            break;
+        }
+        break;
       case CmdState::io_modifier_file_name:
         switch (token.get_type())
         {
@@ -120,12 +186,13 @@ namespace dish::lexer
         switch (token.get_type())
         {
           case TokenType::word: {
+            // n>&- closes n
             auto fd = token.get_content();
-            for (auto r: fd)
+            for (auto r: fd == "-" ? std::string_view{} : fd)
             {
-              if (!std::isdigit(r))
+              if (!std::isdigit(static_cast<unsigned char>(r)))
               {
-                fmt::println(stderr, "Syntax Error: Invalid file descriptor.\n{}", token.get_content(),
+                fmt::println(stderr, "Syntax Error: Invalid file descriptor.\n{}",
                              mark_error_from_token(token));
                 return -1;
               }
@@ -153,6 +220,7 @@ namespace dish::lexer
           case TokenType::rt:
           case TokenType::rt_rt:
           case TokenType::lt_lt:
+          case TokenType::lt_lt_lt:
           case TokenType::lt_rt:
             cmd_state = CmdState::io_modifier_file_name;
             break;
@@ -160,8 +228,20 @@ namespace dish::lexer
           case TokenType::rt_and:
             cmd_state = CmdState::io_modifier_file_desc;
             break;
+          case TokenType::and_and:
+          case TokenType::or_or:
+            cmd_state = CmdState::and_or;
+            break;
+          case TokenType::pipe:
+            cmd_state = CmdState::pipe;
+            break;
           case TokenType::background:
-            cmd_state = CmdState::background;
+          case TokenType::semicolon:
+          case TokenType::dsemi:
+            cmd_state = CmdState::separator;
+            break;
+          case TokenType::newline:
+            cmd_state = CmdState::init;
             break;
           case TokenType::end:
             cmd_state = CmdState::end;
@@ -173,14 +253,23 @@ namespace dish::lexer
             break;
         }
         break;
-      case CmdState::background:
+      case CmdState::separator:
         switch (token.get_type())
         {
+          case TokenType::word:
+          case TokenType::env_var:
+            cmd_state = CmdState::word_or_env;
+            break;
+          case TokenType::dsemi:
+            break;
+          case TokenType::newline:
+            cmd_state = CmdState::init;
+            break;
           case TokenType::end:
             cmd_state = CmdState::end;
             break;
           default:
-            fmt::println(stderr, "Syntax Error: Unexpected '{}' after a background flag.\n{}", token.get_content(),
+            fmt::println(stderr, "Syntax Error: Unexpected '{}' after a separator.\n{}", token.get_content(),
                          mark_error_from_token(token));
             return -1;
             break;
@@ -195,12 +284,15 @@ namespace dish::lexer
     return 0;
   }
 
-  std::vector<Token> Lexer::get_all_tokens_no_check()
+  std::pmr::vector<Token> Lexer::get_all_tokens_no_check(std::pmr::memory_resource *resource)
   {
-    std::vector<Token> ret;
+    std::pmr::vector<Token> ret{resource};
     cmd_state = CmdState::init;
     pos = 0;
-    while (pos < text.length())
+    heredoc_delimiters.clear();
+    expect_delimiter = false;
+    at_heredoc_body = false;
+    while (pos < text.size())
     {
       auto t = get_token();
       ret.emplace_back(t);
@@ -208,17 +300,20 @@ namespace dish::lexer
     return ret;
   }
 
-  std::optional<std::vector<Token>> Lexer::get_all_tokens()
+  std::optional<std::pmr::vector<Token>> Lexer::get_all_tokens(std::pmr::memory_resource *resource)
   {
-    std::vector<Token> ret;
+    std::pmr::vector<Token> ret{resource};
     cmd_state = CmdState::init;
     pos = 0;
-    while (pos < text.length())
+    heredoc_delimiters.clear();
+    expect_delimiter = false;
+    at_heredoc_body = false;
+    while (pos < text.size())
     {
       auto t = get_token();
       if (t.get_type() == TokenType::error)
       {
-        fmt::println(stderr, t.get_content().cpp_str());
+        fmt::println(stderr, "{}\n{}", t.get_error(), mark_error_from_token(t));
         return std::nullopt;
       }
       if (check_cmd(t) != 0)
@@ -226,125 +321,328 @@ namespace dish::lexer
       if (t.get_type() != TokenType::end)
         ret.emplace_back(t);
     }
+    if (has_open_heredoc())
+    {
+      fmt::println(stderr, "Syntax Error: Here-document delimited by '{}' has no end.", heredoc_delimiters.front());
+      return std::nullopt;
+    }
     if (cmd_state != CmdState::end)
     {
-      if (check_cmd(Token{TokenType::end, "end", 0, 0}) != 0)
+      if (check_cmd(Token{TokenType::end, "", text.size()}) != 0)
         return std::nullopt;
     }
     return ret;
   }
 
+  void Lexer::seek(std::size_t pos_)
+  {
+    pos = (std::min)(pos_, text.size());
+  }
+
   Token Lexer::get_token()
   {
-    while (pos < text.length() && text[pos] == ' ') ++pos;
-    if (pos < text.length() && text[pos] == '\n')
-      return Token{TokenType::newline, "\\n", ++pos, 0};
-    else if (pos < text.length() && text[pos] == '|')
-      return Token{TokenType::pipe, "|", pos += 1, 1};
-    else if (pos < text.length() && text[pos] == '&')
-      return Token{TokenType::background, "&", ++pos, 1};
-    else if (pos < text.length() && text[pos] == '<')
+    if (at_heredoc_body)
+      return lex_heredoc_body();
+    auto token = lex_token();
+    switch (token.get_type())
     {
-      if (pos < text.length() - 1 && text[pos + 1] == '<')
-      {
-        if (pos < text.length() - 2 && text[pos + 2] == '<')
-          return Token{TokenType::lt_lt_lt, "<<<", pos += 3, 3};
-        else
-          return Token{TokenType::lt_lt, "<<", pos += 2, 2};
-      }
-      else if (pos < text.length() - 1 && text[pos + 1] == '&')
-        return Token{TokenType::lt_and, "<&", pos += 2, 2};
-      else if (pos < text.length() - 1 && text[pos + 1] == '>')
-        return Token{TokenType::lt_rt, "<>", pos += 2, 2};
-      else
-        return Token{TokenType::lt, "<", ++pos, 1};
+      case TokenType::lt_lt:
+        expect_delimiter = true;
+        break;
+      case TokenType::word:
+      case TokenType::env_var:
+        if (expect_delimiter)
+          heredoc_delimiters.emplace_back(token.get_content());
+        expect_delimiter = false;
+        break;
+      case TokenType::newline:
+        at_heredoc_body = !heredoc_delimiters.empty();
+        expect_delimiter = false;
+        break;
+      default:
+        expect_delimiter = false;
+        break;
     }
-    else if (pos < text.length() && text[pos] == '>')
+    return token;
+  }
+
+  // The lines up to the one that is the delimiter with its quotes removed.
+  Token Lexer::lex_heredoc_body()
+  {
+    std::string delimiter;
+    for (auto c: heredoc_delimiters.front())
     {
-      if (pos < text.length() - 1 && text[pos + 1] == '>')
-        return Token{TokenType::rt_rt, ">>", pos += 2, 2};
-      else if (pos < text.length() - 1 && text[pos + 1] == '&')
-        return Token{TokenType::rt_and, ">&", pos += 2, 2};
-      else
-        return Token{TokenType::rt, ">", ++pos, 1};
+      if (c != '"' && c != '\'')
+        delimiter += c;
     }
-    else if (pos < text.length() && text[pos] == '$')
+    auto beg = pos;
+    while (pos < text.size())
     {
-      ++pos;
-      String tmp = "$";
-      if (text[pos] == '{')
+      auto end = (std::min)(text.find('\n', pos), text.size());
+      if (text.substr(pos, end - pos) == delimiter)
       {
-        tmp += "{";
-        ++pos;
-        if (pos == text.length())
-          return {TokenType::error, tmp, pos, tmp.length(),
-                  "Syntax Error: Unexpected end of token."};
+        Token ret{TokenType::heredoc, text.substr(beg, pos - beg), beg};
+        pos = (std::min)(end + 1, text.size());
+        heredoc_delimiters.erase(heredoc_delimiters.begin());
+        at_heredoc_body = !heredoc_delimiters.empty();
+        return ret;
+      }
+      pos = (std::min)(end + 1, text.size());
+    }
+    // There is no delimiter, the rest of text is in the body. The body stays open, see
+    // has_open_heredoc.
+    at_heredoc_body = false;
+    return Token{TokenType::end, "", text.size()};
+  }
+
+  bool Lexer::has_open_heredoc() const { return !heredoc_delimiters.empty(); }
+
+  Token Lexer::lex_token()
+  {
+    while (pos < text.size() && text[pos] == ' ') ++pos;
+    // a '#' starting a word comments out the rest of the line, the newline is still a token
+    if (pos < text.size() && text[pos] == '#')
+      pos = (std::min)(text.find('\n', pos), text.size());
+    if (pos >= text.size())
+      return Token{TokenType::end, "", text.size()};
+
+    auto op = [this](TokenType type, std::size_t size) {
+      Token ret{type, text.substr(pos, size), pos};
+      pos += size;
+      return ret;
+    };
+    auto next_is = [this](std::size_t offset, char ch) {
+      return pos + offset < text.size() && text[pos + offset] == ch;
+    };
+
+    // The fd of a redirection is part of its operator, e.g. 2>&1 and 3<file.
+    if (std::isdigit(static_cast<unsigned char>(text[pos])))
+    {
+      auto end = pos;
+      while (end < text.size() && std::isdigit(static_cast<unsigned char>(text[end]))) ++end;
+      if (end + 1 < text.size() && (text[end] == '<' || text[end] == '>') && text[end + 1] != '(')
+      {
+        auto beg = pos;
+        pos = end;
+        auto ret = lex_token();
+        return Token{ret.get_type(), text.substr(beg, pos - beg), beg};
+      }
+    }
 
-        while (pos < text.length() && text[pos] != '}')
+    switch (text[pos])
+    {
+      case '\n':
+        return op(TokenType::newline, 1);
+      case ';':
+        if (next_is(1, ';'))
+          return op(TokenType::dsemi, 2);
+        return op(TokenType::semicolon, 1);
+      case '(':
+        return op(TokenType::lparen, 1);
+      case ')':
+        return op(TokenType::rparen, 1);
+      case '|':
+        if (next_is(1, '|'))
+          return op(TokenType::or_or, 2);
+        return op(TokenType::pipe, 1);
+      case '&':
+        if (next_is(1, '&'))
+          return op(TokenType::and_and, 2);
+        // &> and &>> also redirect stderr
+        if (next_is(1, '>'))
         {
-          tmp += text[pos];
-          ++pos;
+          if (next_is(2, '>'))
+            return op(TokenType::rt_rt, 3);
+          return op(TokenType::rt, 2);
         }
-
-        if (pos == text.length() || text[pos] != '}')
+        return op(TokenType::background, 1);
+      case '<':
+        if (next_is(1, '('))
+          break;// <(command) is a word
+        if (next_is(1, '<'))
         {
-          return {TokenType::error, tmp, pos, tmp.length(),
-                  "Syntax Error: Unexpected end of token."};
+          if (next_is(2, '<'))
+            return op(TokenType::lt_lt_lt, 3);
+          return op(TokenType::lt_lt, 2);
         }
-        tmp += "}";
-        pos++;//skip '}'
+        else if (next_is(1, '&'))
+          return op(TokenType::lt_and, 2);
+        else if (next_is(1, '>'))
+          return op(TokenType::lt_rt, 2);
+        return op(TokenType::lt, 1);
+      case '>':
+        if (next_is(1, '('))
+          break;// >(command) is a word
+        if (next_is(1, '>'))
+          return op(TokenType::rt_rt, 2);
+        else if (next_is(1, '&'))
+          return op(TokenType::rt_and, 2);
+        return op(TokenType::rt, 1);
+      default:
+        break;
+    }
+
+    // A word starting with '$' is an env_var, '$' and quotes do not end a word, e.g. a$B"c d".
+    // ${...} and $(...) are part of the word even if they contain spaces.
+    std::size_t beg = pos;
+    // from a '(' to after the matching ')'
+    auto skip_parens = [this] {
+      auto end = utils::find_matching_paren(text, pos);
+      if (end == std::string_view::npos)
+      {
+        pos = text.size();
+        return false;
       }
-      else
+      pos = end + 1;//skip ')'
+      return true;
+    };
+    while (true)
+    {
+      pos = find_special(text, pos);
+      if (pos >= text.size())
+        break;
+      if (text[pos] == '"')
       {
-        while (pos < text.length() && !std::isspace(text[pos]))
+        pos = text.find('"', pos + 1);
+        if (pos == std::string_view::npos)
         {
-          tmp += text[pos];
-          ++pos;
+          pos = text.size();
+          return Token{TokenType::error, text.substr(beg), beg,
+                       "Syntax Error: Unexpected end of token."};
         }
+        ++pos;//skip '"'
       }
-      if (tmp.length() == 1)
+      else if (text[pos] == '$')
       {
-        return {TokenType::error, tmp, pos, tmp.length(),
-                "Syntax Error: Unexpected end of token."};
+        ++pos;
+        if (pos < text.size() && text[pos] == '{')
+        {
+          pos = text.find('}', pos);
+          if (pos == std::string_view::npos)
+          {
+            pos = text.size();
+            return Token{TokenType::error, text.substr(beg), beg,
+                         "Syntax Error: Unexpected end of token."};
+          }
+          ++pos;//skip '}'
+        }
+        else if (pos < text.size() && text[pos] == '(')
+        {
+          // $(( )), up to the matching ')'
+          if (!skip_parens())
+          {
+            return Token{TokenType::error, text.substr(beg), beg,
+                         "Syntax Error: Unexpected end of token."};
+          }
+        }
       }
-      return Token{TokenType::env_var, tmp, pos, tmp.length()};
-    }
-    else if (pos >= text.length())
-      return Token{TokenType::end, "end", 0, 0};
-    else
-    {
-      String tmp;
-      bool parsing_str = false;
-      while (pos < text.length() && (parsing_str || text[pos] != ' '))
+      else if (pos == beg && (text[pos] == '<' || text[pos] == '>'))
       {
-        if (text[pos] == '"')
+        // <(command) and >(command)
+        ++pos;
+        if (!skip_parens())
         {
-          parsing_str = !parsing_str;
-          tmp += '"';
+          return Token{TokenType::error, text.substr(beg), beg,
+                       "Syntax Error: Unexpected end of token."};
         }
-        else
-          tmp += text[pos];
-        ++pos;
       }
-      if (parsing_str)
-        return Token{TokenType::error, tmp, pos, tmp.length(),
+      else
+        break;
+    }
+    if (text[beg] == '$')
+    {
+      if (pos - beg == 1)
+      {
+        return Token{TokenType::error, text.substr(beg, 1), beg,
                      "Syntax Error: Unexpected end of token."};
-      return Token{TokenType::word, tmp, pos, tmp.length()};
+      }
+      return Token{TokenType::env_var, text.substr(beg, pos - beg), beg};
     }
-    return Token{TokenType::end, "end", 0, 0};
+    return Token{TokenType::word, text.substr(beg, pos - beg), beg};
   }
 
   String Lexer::mark_error_from_token(const Token &token) const
   {
-    std::size_t size = token.get_size();
-    std::size_t errpos = token.get_pos();
-    String marked = text;
+    auto prefix = text.substr(0, token.get_pos());
+    auto content = token.get_content();
+    String marked = utils::to_string(text);
     marked += "\n";
-    if (errpos >= size)
-      marked += String(errpos - size, ' ');
+    marked += String(utils::display_width(utils::to_string(prefix)), ' ');
     marked += "\033[0;32;32m";
-    marked += String(size, '^');
+    marked += String((std::max)(utils::display_width(utils::to_string(content)), std::size_t{1}), '^');
     marked += "\033[m";
     return marked;
   }
-}// namespace dish::lexer
\ No newline at end of file
+
+  std::size_t find_special(std::string_view text, std::size_t pos)
+  {
+    const char *data = text.data();
+    const std::size_t size = text.size();
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i semicolon = _mm_set1_epi8(';');
+    const __m128i lparen = _mm_set1_epi8('(');
+    const __m128i rparen = _mm_set1_epi8(')');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i rt = _mm_set1_epi8('>');
+    const __m128i dollar = _mm_set1_epi8('$');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= size; pos += 16)
+    {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+      __m128i m = _mm_or_si128(
+              _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, pipe)),
+                           _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt))),
+              _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, rt), _mm_cmpeq_epi8(v, dollar)),
+                           _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, newline))));
+      m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, semicolon),
+                                        _mm_or_si128(_mm_cmpeq_epi8(v, lparen), _mm_cmpeq_epi8(v, rparen))));
+      if (int mask = _mm_movemask_epi8(m); mask != 0)
+        return pos + __builtin_ctz(mask);
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // SWAR: test 8 bytes at once. The lowest flagged byte is always exact, the borrow of
+    // the subtraction can only produce false positives above a real match.
+    constexpr std::uint64_t ones = 0x0101010101010101ULL;
+    constexpr std::uint64_t highs = 0x8080808080808080ULL;
+    auto has_byte = [](std::uint64_t word, unsigned char ch) {
+      std::uint64_t x = word ^ (ones * ch);
+      return (x - ones) & ~x & highs;
+    };
+    for (; pos + 8 <= size; pos += 8)
+    {
+      std::uint64_t word;
+      std::memcpy(&word, data + pos, 8);
+      std::uint64_t m = has_byte(word, ' ') | has_byte(word, '|') | has_byte(word, '&') | has_byte(word, '<') |
+                        has_byte(word, '>') | has_byte(word, '$') | has_byte(word, '"') | has_byte(word, '\n') |
+                        has_byte(word, ';') | has_byte(word, '(') | has_byte(word, ')');
+      if (m != 0)
+        return pos + (__builtin_ctzll(m) >> 3);
+    }
+#endif
+    for (; pos < size; ++pos)
+    {
+      switch (data[pos])
+      {
+        case ' ':
+        case '|':
+        case '&':
+        case ';':
+        case '(':
+        case ')':
+        case '<':
+        case '>':
+        case '$':
+        case '"':
+        case '\n':
+          return pos;
+        default:
+          break;
+      }
+    }
+    return size;
+  }
+}// namespace dish::lexer
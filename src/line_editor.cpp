@@ -13,19 +13,25 @@
 //   limitations under the License.
 
 #include "dish/line_editor.hpp"
+#include "dish/event_loop.hpp"
+#include "dish/expansion.hpp"
 #include "dish/lexer.hpp"
 #include "dish/utils.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 namespace dish::line_editor
 {
@@ -122,60 +128,208 @@ namespace dish::line_editor
     return static_cast<utils::Effect>(dish_context.lua_state["dish"]["style"][type.cpp_str()].get<int>());
   }
 
-  String highlight_line()
+  // The tokens of the last highlighted line with their styled text. highlight_line() only
+  // re-lexes and restyles the tokens touched by an edit and reuses the others.
+  struct HighlightToken
   {
-    auto cmd_color = get_style("cmd");
-    auto arg_color = get_style("arg");
-    auto str_color = get_style("string");
-    auto env_color = get_style("env");
-    auto err_color = get_style("error");
+    lexer::TokenType type;
+    size_t pos;
+    size_t size;
+    bool is_cmd;
+    std::string styled;
+  };
+
+  struct HighlightCache
+  {
+    std::string line;
+    std::vector<HighlightToken> tokens;
+    std::vector<utils::Effect> styles;
+    // command word -> found, cleared for every new line
+    std::unordered_map<std::string, bool> commands;
+  };
 
-    auto tokens = lexer::Lexer(dle_context.line).get_all_tokens_no_check();
+  HighlightCache dle_highlight_cache;
+
+  std::string highlight_token(std::string_view content, lexer::TokenType type, bool is_cmd)
+  {
+    const auto &styles = dle_highlight_cache.styles;
+    auto cmd_color = styles[0];
+    auto arg_color = styles[1];
+    auto str_color = styles[2];
+    auto env_color = styles[3];
+    auto err_color = styles[4];
+    String curr_word = utils::to_string(content);
+    if (is_cmd && expansion::is_assignment(content))
+      return utils::effect(curr_word, env_color).cpp_str();
+    if (is_cmd)
+    {
+      auto &commands = dle_highlight_cache.commands;
+      auto it = commands.find(std::string{content});
+      if (it == commands.end())
+      {
+        auto [cmd_type, cmd_path] = utils::find_command(curr_word);
+        bool found = cmd_type != utils::CommandType::not_found && cmd_type != utils::CommandType::not_executable;
+        it = commands.emplace(std::string{content}, found).first;
+      }
+      return utils::effect(curr_word, it->second ? cmd_color : err_color).cpp_str();
+    }
+    else if (type == lexer::TokenType::env_var)
+      return utils::effect(curr_word, env_color).cpp_str();
+    else if (type == lexer::TokenType::word)
+    {
+      if (curr_word[0] == '"')
+        return utils::effect(curr_word, str_color).cpp_str();
+      return utils::effect(curr_word, arg_color).cpp_str();
+    }
+    else if (type == lexer::TokenType::error)
+      return utils::effect(curr_word, err_color).cpp_str();
+    return std::string{content};
+  }
 
-    String ret;
-    for (size_t i = 0; i < dle_context.line.length() && dle_context.line[i] == ' '; ++i)
-      ret += ' ';
+  bool is_cmd_position(lexer::TokenType type, const HighlightToken *prev)
+  {
+    if (type != lexer::TokenType::word) return false;
+    if (prev == nullptr) return true;
+    switch (prev->type)
+    {
+      case lexer::TokenType::pipe:
+      case lexer::TokenType::and_and:
+      case lexer::TokenType::or_or:
+      case lexer::TokenType::semicolon:
+      case lexer::TokenType::background:
+      case lexer::TokenType::newline:
+        return true;
+      default:
+        return false;
+    }
+  }
 
-    for (auto it = tokens.cbegin(); it != tokens.cend(); ++it)
+  String highlight_line()
+  {
+    auto &cache = dle_highlight_cache;
+    std::vector<utils::Effect> styles{get_style("cmd"), get_style("arg"), get_style("string"),
+                                      get_style("env"), get_style("error")};
+    if (styles != cache.styles)
     {
-      if (it->get_type() == lexer::TokenType::end) break;
-      String curr_word = it->get_content();
-      String space;
-      for (size_t i = it->get_pos(); i < dle_context.line.length() && dle_context.line[i] == ' '; ++i)
-        space += ' ';
+      cache.styles = std::move(styles);
+      cache.line.clear();
+      cache.tokens.clear();
+    }
 
-      if ((it == tokens.cbegin() && it->get_type() == lexer::TokenType::word) || ((it - 1)->get_type() == lexer::TokenType::pipe && it->get_type() == lexer::TokenType::word))
+    auto line = utils::to_view(dle_context.line);
+    std::string_view old_line = cache.line;
+    auto &tokens = cache.tokens;
+
+    // The edit is the region between the common prefix and suffix of the old and new line.
+    size_t prefix = std::mismatch(line.begin(), line.begin() + (std::min)(line.size(), old_line.size()),
+                                  old_line.begin())
+                            .first -
+                    line.begin();
+    size_t suffix = 0;
+    size_t max_suffix = (std::min)(line.size(), old_line.size()) - prefix;
+    while (suffix < max_suffix && line[line.size() - 1 - suffix] == old_line[old_line.size() - 1 - suffix])
+      ++suffix;
+    size_t edit_end = line.size() - suffix;
+    std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(line.size()) - static_cast<std::ptrdiff_t>(old_line.size());
+
+    // A token only depends on its bytes and the byte ending it, so tokens ended before the
+    // edit are still valid. A here-document body ends after its delimiter line.
+    auto token_end = [old_line](const HighlightToken &t) {
+      if (t.type != lexer::TokenType::heredoc)
+        return t.pos + t.size;
+      return (std::min)(old_line.find('\n', t.pos + t.size), old_line.size() - 1) + 1;
+    };
+    auto keep = std::partition_point(tokens.begin(), tokens.end(),
+                                     [prefix, &token_end](const HighlightToken &t) { return token_end(t) < prefix; }) -
+                tokens.begin();
+    // The lexer does not keep the delimiters of the << before the seek, so it restarts before
+    // the first << whose body is not kept.
+    auto open_heredoc = keep;
+    size_t open_count = 0;
+    for (decltype(keep) i = 0; i < keep; ++i)
+    {
+      if (tokens[i].type == lexer::TokenType::lt_lt && open_count++ == 0)
+        open_heredoc = i;
+      else if (tokens[i].type == lexer::TokenType::heredoc && open_count != 0)
+        --open_count;
+    }
+    if (open_count != 0)
+      keep = open_heredoc;
+
+    lexer::Lexer lexer{line};
+    lexer.seek(keep == 0 ? 0 : token_end(tokens[keep - 1]));
+    std::vector<HighlightToken> fresh;
+    size_t old_i = keep;
+    // The << of the old line before old_i whose body is not before it.
+    size_t old_open_count = 0;
+    bool synced = false;
+    while (true)
+    {
+      auto t = lexer.get_token();
+      if (t.get_type() == lexer::TokenType::end) break;
+      // Once a token starts in the unchanged suffix where an old token started, the rest of
+      // the line lexes exactly as before, unless a here-document is open in either line.
+      if (t.get_pos() >= edit_end)
       {
-        auto [type, cmd_path] = utils::find_command(curr_word);
-        switch (type)
+        while (old_i < tokens.size() && static_cast<std::ptrdiff_t>(tokens[old_i].pos) + delta < static_cast<std::ptrdiff_t>(t.get_pos()))
         {
-          case utils::CommandType::not_found:
-          case utils::CommandType::not_executable:
-            ret += utils::effect(curr_word, err_color);
-            break;
-          case utils::CommandType::builtin:
-          case utils::CommandType::lua_func:
-          case utils::CommandType::executable_file:
-          case utils::CommandType::executable_link:
-            ret += utils::effect(curr_word, cmd_color);
-            break;
+          if (tokens[old_i].type == lexer::TokenType::lt_lt)
+            ++old_open_count;
+          else if (tokens[old_i].type == lexer::TokenType::heredoc && old_open_count != 0)
+            --old_open_count;
+          ++old_i;
+        }
+        if (old_i < tokens.size() && static_cast<std::ptrdiff_t>(tokens[old_i].pos) + delta == static_cast<std::ptrdiff_t>(t.get_pos()) && tokens[old_i].type == t.get_type() && tokens[old_i].size == t.get_size() && old_open_count == 0 && !lexer.has_open_heredoc())
+        {
+          synced = true;
+          break;
         }
       }
-      else if (it->get_type() == lexer::TokenType::env_var)
-        ret += utils::effect(curr_word, env_color);
-      else if (it->get_type() == lexer::TokenType::word)
+      const HighlightToken *prev = nullptr;
+      if (!fresh.empty())
+        prev = &fresh.back();
+      else if (keep != 0)
+        prev = &tokens[keep - 1];
+      bool is_cmd = is_cmd_position(t.get_type(), prev);
+      fresh.emplace_back(HighlightToken{t.get_type(), t.get_pos(), t.get_size(), is_cmd,
+                                        highlight_token(t.get_content(), t.get_type(), is_cmd)});
+    }
+
+    // tokens = kept + fresh + shifted old suffix
+    if (synced)
+    {
+      for (auto it = tokens.begin() + old_i; it != tokens.end(); ++it)
+        it->pos += delta;
+      auto first_synced = tokens.erase(tokens.begin() + keep, tokens.begin() + old_i);
+      tokens.insert(first_synced, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+      // The token before the first reused one may have changed.
+      auto &t = tokens[keep + fresh.size()];
+      const HighlightToken *prev = keep + fresh.size() == 0 ? nullptr : &tokens[keep + fresh.size() - 1];
+      if (bool is_cmd = is_cmd_position(t.type, prev); is_cmd != t.is_cmd)
       {
-        if (curr_word[0] == '"')
-          ret += utils::effect(curr_word, str_color);
-        else
-          ret += utils::effect(curr_word, arg_color);
+        t.is_cmd = is_cmd;
+        t.styled = highlight_token(line.substr(t.pos, t.size), t.type, is_cmd);
       }
-      else if (it->get_type() == lexer::TokenType::error)
-        ret += utils::effect(curr_word, err_color);
-      else
-        ret += curr_word;
-      ret += space;
     }
+    else
+    {
+      tokens.erase(tokens.begin() + keep, tokens.end());
+      tokens.insert(tokens.end(), std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    }
+    cache.line.assign(line);
+
+    std::string styled;
+    styled.reserve(line.size() * 2);
+    // everything between two tokens is copied as it is.
+    size_t last = 0;
+    for (auto &t: tokens)
+    {
+      styled.append(line.substr(last, t.pos - last));
+      styled.append(t.styled);
+      last = t.pos + t.size;
+    }
+    styled.append(line.substr(last));
+    String ret{std::move(styled)};
 
     if (!dle_context.searching_history_pattern.empty())
     {
@@ -186,9 +340,6 @@ namespace dish::line_editor
         ret.insert(beg + 9 + dle_context.searching_history_pattern.length(), "\033[49m");
       }
     }
-    size_t a = utils::display_width(ret);
-    size_t b = utils::display_width(dle_context.line);
-    assert(a == b);
     return ret;
   }
 
@@ -943,6 +1094,59 @@ namespace dish::line_editor
     return len;
   }
 
+  // Job notifications and the output of timers are written above the line being edited,
+  // which is drawn again after them.
+  void handle_events(unsigned events)
+  {
+    auto prompt_lines = std::count(dle_context.prompt.begin(), dle_context.prompt.end(), '\n');
+    if (prompt_lines != 0)
+      dle_write("\r\x1b[{}A\x1b[J", prompt_lines);
+    else
+      dle_write("\r\x1b[J");
+    std::cout.flush();
+    if (events & event_loop::children)
+      do_job_notification();
+    if (events & event_loop::timer)
+      event_loop::run_timers();
+    std::fflush(stdout);
+    dle_write(dle_context.prompt);
+    dle_context.last_cols = 0;
+    edit_refresh_line(dish_context.lua_state["dish"]["enable_hint"]);
+  }
+
+  // Terminal input is read in blocks, but handed to the editor byte by byte.
+  char input_buffer[256];
+  std::size_t input_pos = 0;
+  std::size_t input_size = 0;
+
+  void read_input(char *buf, std::size_t n)
+  {
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      while (input_pos == input_size)
+      {
+        std::cout.flush();
+        auto events = event_loop::wait(dish_context.terminal);
+        if (events & ~event_loop::input)
+          handle_events(events);
+        if (!(events & event_loop::input))
+          continue;
+        auto size = read(dish_context.terminal, input_buffer, sizeof(input_buffer));
+        if (size == -1 && errno == EINTR)
+          continue;
+        if (size <= 0)
+        {
+          // The terminal is gone. ^C gives up the line.
+          dish_context.running = false;
+          input_buffer[0] = static_cast<char>(SpecialKey::CTRL_C);
+          size = 1;
+        }
+        input_pos = 0;
+        input_size = static_cast<std::size_t>(size);
+      }
+      buf[i] = input_buffer[input_pos++];
+    }
+  }
 
   // the core of Dish Line Editor
   int edit_line()
@@ -952,11 +1156,13 @@ namespace dish::line_editor
     dle_context.pos = 0;
     dle_context.history.emplace_back(History{"", ""});
     dle_context.history_pos = dle_context.history.size() - 1;
+    // commands may have been installed or removed by the last line
+    dle_highlight_cache.commands.clear();
     std::string codepoint_buf;
     while (true)
     {
       char buf;
-      std::cin.read(&buf, 1);
+      read_input(&buf, 1);
       if (is_special_key(static_cast<int>(buf)))
       {
         SpecialKey key = static_cast<SpecialKey>(buf);
@@ -1077,7 +1283,7 @@ namespace dish::line_editor
           }
           case SpecialKey::ESC:// Escape Sequence
             char seq[3];
-            std::cin.read(seq, 1);
+            read_input(seq, 1);
             // esc ?
             if (seq[0] != '[' && seq[0] != 'O')
             {
@@ -1096,20 +1302,20 @@ namespace dish::line_editor
             }
             else
             {
-              std::cin.read(seq + 1, 1);
+              read_input(seq + 1, 1);
               // esc [
               if (seq[0] == '[')
               {
                 if (seq[1] >= '0' && seq[1] <= '9')
                 {
-                  std::cin.read(seq + 2, 1);
+                  read_input(seq + 2, 1);
                   if (seq[2] == '~' && seq[1] == '3')
                   {
                     edit_delete();
                   }
                   else if (seq[2] == ';')
                   {
-                    std::cin.read(seq, 2);
+                    read_input(seq, 2);
                     if (seq[0] == '5' && seq[1] == 'C')
                       move_to_word_end();
                     if (seq[0] == '5' && seq[1] == 'D')
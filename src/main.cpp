@@ -13,15 +13,51 @@
 //   limitations under the License.
 
 #include "dish/dish.hpp"
+#include "dish/lexer.hpp"
 #include "dish/line_editor.hpp"
+#include "dish/script.hpp"
 #include "dish/type_alias.hpp"
 #include "dish/utils.hpp"
+#include "dish/variable.hpp"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
 
 using namespace dish;
 
 int main(int argc, char **argv)
 {
-  dish_init();
+  // dish -c command [$0 [args...]], dish script [args...], or commands from stdin if it is
+  // not a terminal
+  bool has_command = argc >= 2 && std::strcmp(argv[1], "-c") == 0;
+  if (has_command && argc == 2)
+  {
+    fmt::println(stderr, "dish: -c: option requires an argument");
+    return 2;
+  }
+  if (has_command || argc >= 2 || !isatty(STDIN_FILENO))
+  {
+    dish_init(false);
+    std::vector<String> args;
+    for (int i = has_command ? 3 : 1; i < argc; ++i)
+      args.emplace_back(argv[i]);
+    if (args.empty())
+      args.emplace_back(argv[0]);
+    variable::variable_table.push_args(&args);
+    int ret;
+    if (has_command)
+      ret = script::run_string(argv[2]);
+    else if (argc >= 2)
+      ret = script::run_file(argv[1]);
+    else
+      ret = script::run_stream(STDIN_FILENO);
+    variable::variable_table.pop_args();
+    return ret;
+  }
+
+  dish_init(true);
   String history = dish_context.lua_state["dish"]["history_path"].get<std::string>();
   line_editor::dle_init();
   line_editor::load_history(history);
@@ -37,6 +73,15 @@ int main(int argc, char **argv)
     if (prompt.empty()) prompt = dish_default_prompt();
 
     String line = line_editor::read_line(prompt);
+    // the body of a here-document is on the next lines
+    while (dish_context.running)
+    {
+      lexer::Lexer lexer{line};
+      lexer.get_all_tokens_no_check();
+      if (!lexer.has_open_heredoc()) break;
+      line += '\n';
+      line += line_editor::read_line("> ");
+    }
     run_command(line);
   }
   line_editor::save_history(history);
@@ -0,0 +1,690 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/builtin.hpp"
+#include "dish/dish.hpp"
+#include "dish/job.hpp"
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace dish::builtin
+{
+  int native_true(Args)
+  {
+    return 0;
+  }
+
+  int native_false(Args)
+  {
+    return 1;
+  }
+
+  // The escape sequences of echo -e, of the argument of printf %b and of printf formats. The
+  // octal escapes of echo are \0nnn, those of formats \nnn, and %b has both, like bash and
+  // coreutils. \c sets stop except in formats.
+  enum class EscapeMode
+  {
+    echo,
+    percent_b,
+    format
+  };
+
+  // Appends the character of the escape sequence after the '\' at str[pos - 1], and returns
+  // the position after the sequence.
+  std::size_t append_escape(std::string &out, std::string_view str, std::size_t pos, EscapeMode mode, bool &stop)
+  {
+    auto is_octal = [](char ch) { return ch >= '0' && ch <= '7'; };
+    if (pos == str.size())
+    {
+      out += '\\';
+      return pos;
+    }
+    char ch = str[pos++];
+    switch (ch)
+    {
+      case 'a': out += '\a'; break;
+      case 'b': out += '\b'; break;
+      case 'e': out += '\x1b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'v': out += '\v'; break;
+      case '\\': out += '\\'; break;
+      case 'c':
+        if (mode != EscapeMode::format)
+          stop = true;
+        else
+          out += "\\c";
+        break;
+      case 'x': {
+        int value = 0;
+        std::size_t digits = 0;
+        for (; digits < 2 && pos < str.size() && std::isxdigit(static_cast<unsigned char>(str[pos])); ++digits, ++pos)
+        {
+          char hex = str[pos];
+          value = value * 16 + (std::isdigit(static_cast<unsigned char>(hex)) ? hex - '0' : (hex | 0x20) - 'a' + 10);
+        }
+        if (digits == 0)
+          out += "\\x";
+        else
+          out += static_cast<char>(value);
+      }
+      break;
+      default:
+        if (is_octal(ch) && (mode != EscapeMode::echo || ch == '0'))
+        {
+          // the 0 of \0nnn is not one of the 3 digits
+          bool leading_zero = mode != EscapeMode::format && ch == '0';
+          int value = leading_zero ? 0 : ch - '0';
+          std::size_t max_digits = leading_zero ? 3 : 2;
+          for (std::size_t digits = 0; digits < max_digits && pos < str.size() && is_octal(str[pos]); ++digits, ++pos)
+            value = value * 8 + (str[pos] - '0');
+          out += static_cast<char>(value);
+        }
+        else
+        {
+          out += '\\';
+          out += ch;
+        }
+        break;
+    }
+    return pos;
+  }
+
+  // Returns whether \c was found.
+  bool append_escaped(std::string &out, std::string_view str, EscapeMode mode)
+  {
+    bool stop = false;
+    for (std::size_t pos = 0; pos < str.size() && !stop;)
+    {
+      auto backslash = str.find('\\', pos);
+      out.append(str.substr(pos, backslash - pos));
+      if (backslash == std::string_view::npos)
+        break;
+      pos = append_escape(out, str, backslash + 1, mode, stop);
+    }
+    return stop;
+  }
+
+  int write_stdout(const std::string &out)
+  {
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    if (std::fflush(stdout) != 0)
+    {
+      std::clearerr(stdout);
+      return 1;
+    }
+    return 0;
+  }
+
+  // echo [-neE] [arg...], like the echo of bash and coreutils
+  int native_echo(Args args)
+  {
+    bool newline = true;
+    bool escape = false;
+    std::size_t i = 1;
+    for (; i < args.size(); ++i)
+    {
+      std::string_view arg{args[i].data(), args[i].size()};
+      if (arg.size() < 2 || arg[0] != '-' || arg.find_first_not_of("neE", 1) != std::string_view::npos)
+        break;
+      for (auto ch: arg)
+      {
+        if (ch == 'n') newline = false;
+        else if (ch == 'e') escape = true;
+        else if (ch == 'E') escape = false;
+      }
+    }
+    std::string out;
+    for (std::size_t first = i; i < args.size(); ++i)
+    {
+      if (i != first)
+        out += ' ';
+      std::string_view arg{args[i].data(), args[i].size()};
+      if (!escape)
+        out.append(arg);
+      else if (append_escaped(out, arg, EscapeMode::echo))
+        return write_stdout(out);
+    }
+    if (newline)
+      out += '\n';
+    return write_stdout(out);
+  }
+
+  // An argument of a numeric conversion: a C constant, or the value of the character after a
+  // leading quote. Sets failed if it is not a number.
+  template<typename T>
+  T to_number(const String &arg, bool &failed)
+  {
+    if (arg.empty())
+      return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+      return arg.length() > 1 ? static_cast<T>(arg[1]) : 0;
+    char *end = nullptr;
+    errno = 0;
+    T value;
+    if constexpr (std::is_floating_point_v<T>)
+      value = std::strtod(arg.c_str(), &end);
+    else if constexpr (std::is_signed_v<T>)
+      value = std::strtoll(arg.c_str(), &end, 0);
+    else
+      value = arg[0] == '-' ? static_cast<T>(std::strtoll(arg.c_str(), &end, 0)) : std::strtoull(arg.c_str(), &end, 0);
+    if (*end != '\0' || errno == ERANGE)
+    {
+      fmt::println(stderr, "printf: {}: invalid number", arg);
+      failed = true;
+    }
+    return value;
+  }
+
+  template<typename T>
+  void append_format(std::string &out, const std::string &spec, T value)
+  {
+    int size = std::snprintf(nullptr, 0, spec.c_str(), value);
+    if (size <= 0)
+      return;
+    auto old = out.size();
+    out.resize(old + size + 1);
+    std::snprintf(out.data() + old, size + 1, spec.c_str(), value);
+    out.resize(old + size);
+  }
+
+  // printf format [arg...]. The format is reused until all the arguments are consumed.
+  int native_printf(Args args)
+  {
+    std::size_t argi = 1;
+    if (argi < args.size() && args[argi] == "--")
+      ++argi;
+    if (argi >= args.size())
+    {
+      fmt::println(stderr, "printf: usage: printf format [arguments]");
+      return 2;
+    }
+    std::string_view format{args[argi].data(), args[argi].size()};
+    ++argi;
+    std::string out;
+    bool failed = false;
+    static const String empty;
+    auto next_arg = [&]() -> const String & { return argi < args.size() ? args[argi++] : empty; };
+    while (true)
+    {
+      auto first_arg = argi;
+      for (std::size_t pos = 0; pos < format.size();)
+      {
+        char ch = format[pos++];
+        if (ch == '\\')
+        {
+          bool stop = false;
+          pos = append_escape(out, format, pos, EscapeMode::format, stop);
+          continue;
+        }
+        if (ch != '%')
+        {
+          out += ch;
+          continue;
+        }
+        if (pos < format.size() && format[pos] == '%')
+        {
+          out += '%';
+          ++pos;
+          continue;
+        }
+        std::string spec = "%";
+        auto spec_begin = pos;
+        while (pos < format.size() && std::strchr("-+ #0", format[pos]) != nullptr)
+          spec += format[pos++];
+        // the width and the precision, '*' takes them from the arguments
+        for (int part = 0; part < 2; ++part)
+        {
+          if (part == 1)
+          {
+            if (pos >= format.size() || format[pos] != '.')
+              break;
+            spec += format[pos++];
+          }
+          if (pos < format.size() && format[pos] == '*')
+          {
+            spec += std::to_string(to_number<long long>(next_arg(), failed));
+            ++pos;
+          }
+          else
+          {
+            while (pos < format.size() && std::isdigit(static_cast<unsigned char>(format[pos])))
+              spec += format[pos++];
+          }
+        }
+        if (pos >= format.size())
+        {
+          fmt::println(stderr, "printf: %{}: missing format character", format.substr(spec_begin));
+          write_stdout(out);
+          return 1;
+        }
+        char conversion = format[pos++];
+        switch (conversion)
+        {
+          case 's':
+            append_format(out, spec + 's', next_arg().c_str());
+            break;
+          case 'b': {
+            std::string expanded;
+            auto &arg = next_arg();
+            bool stop = append_escaped(expanded, {arg.data(), arg.size()}, EscapeMode::percent_b);
+            // \0 is kept unless there is a width or a precision
+            if (spec == "%")
+              out += expanded;
+            else
+              append_format(out, spec + 's', expanded.c_str());
+            if (stop)
+              return write_stdout(out) | failed;
+          }
+          break;
+          case 'c': {
+            auto &arg = next_arg();
+            append_format(out, spec + 'c', arg.empty() ? 0 : static_cast<int>(static_cast<unsigned char>(arg[0])));
+          }
+          break;
+          case 'd':
+          case 'i':
+            append_format(out, spec + "ll" + conversion, to_number<long long>(next_arg(), failed));
+            break;
+          case 'o':
+          case 'u':
+          case 'x':
+          case 'X':
+            append_format(out, spec + "ll" + conversion, to_number<unsigned long long>(next_arg(), failed));
+            break;
+          case 'a':
+          case 'A':
+          case 'e':
+          case 'E':
+          case 'f':
+          case 'F':
+          case 'g':
+          case 'G':
+            append_format(out, spec + conversion, to_number<double>(next_arg(), failed));
+            break;
+          default:
+            fmt::println(stderr, "printf: %{}: invalid format character", format.substr(spec_begin, pos - spec_begin));
+            write_stdout(out);
+            return 1;
+        }
+      }
+      if (argi >= args.size() || argi == first_arg)
+        break;
+    }
+    return write_stdout(out) | failed;
+  }
+
+  // The expression of test and [, with the rules of POSIX for up to 4 arguments and -a, -o,
+  // '!' and parentheses for more.
+  class TestExpression
+  {
+  private:
+    std::vector<std::string_view> argv;
+    std::size_t pos;
+    bool error;
+
+  public:
+    TestExpression(std::vector<std::string_view> argv_) : argv(std::move(argv_)), pos(0), error(false) {}
+
+    // Returns 0 if true, 1 if false and 2 on error.
+    int evaluate()
+    {
+      bool ret = evaluate(0, argv.size());
+      if (!error && pos != argv.size())
+        fail(fmt::format("{}: unexpected argument", argv[pos]));
+      return error ? 2 : !ret;
+    }
+
+  private:
+    void fail(const std::string &message)
+    {
+      if (!error)
+        fmt::println(stderr, "test: {}", message);
+      error = true;
+    }
+
+    static bool is_unary(std::string_view op)
+    {
+      return op.size() == 2 && op[0] == '-' && std::strchr("bcdefghkLnprsStuwxzGO", op[1]) != nullptr;
+    }
+
+    static bool is_binary(std::string_view op)
+    {
+      static const std::string_view ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                             "-gt", "-ge", "-nt", "-ot", "-ef"};
+      for (auto r: ops)
+      {
+        if (op == r)
+          return true;
+      }
+      return false;
+    }
+
+    bool evaluate(std::size_t begin, std::size_t end)
+    {
+      pos = begin;
+      auto n = end - begin;
+      if (n == 0)
+        return false;
+      if (n == 1)
+      {
+        pos = end;
+        return !argv[begin].empty();
+      }
+      if (n == 2)
+      {
+        if (argv[begin] == "!")
+        {
+          pos = end;
+          return argv[begin + 1].empty();
+        }
+        if (is_unary(argv[begin]))
+        {
+          pos = end;
+          return unary(argv[begin], argv[begin + 1]);
+        }
+      }
+      else if (n == 3)
+      {
+        if (is_binary(argv[begin + 1]))
+        {
+          pos = end;
+          return binary(argv[begin], argv[begin + 1], argv[begin + 2]);
+        }
+        if (argv[begin] == "!")
+          return !evaluate(begin + 1, end);
+        if (argv[begin] == "(" && argv[end - 1] == ")")
+        {
+          pos = end;
+          return !argv[begin + 1].empty();
+        }
+      }
+      else if (n == 4)
+      {
+        if (argv[begin] == "!")
+          return !evaluate(begin + 1, end);
+        if (argv[begin] == "(" && argv[end - 1] == ")")
+        {
+          bool ret = evaluate(begin + 1, end - 1);
+          pos = end;
+          return ret;
+        }
+      }
+      return parse_or();
+    }
+
+    std::string_view next()
+    {
+      if (pos >= argv.size())
+      {
+        fail("argument expected");
+        return {};
+      }
+      return argv[pos++];
+    }
+
+    bool parse_or()
+    {
+      bool ret = parse_and();
+      while (!error && pos < argv.size() && argv[pos] == "-o")
+      {
+        ++pos;
+        ret = parse_and() || ret;
+      }
+      return ret;
+    }
+
+    bool parse_and()
+    {
+      bool ret = parse_not();
+      while (!error && pos < argv.size() && argv[pos] == "-a")
+      {
+        ++pos;
+        ret = parse_not() && ret;
+      }
+      return ret;
+    }
+
+    bool parse_not()
+    {
+      if (pos < argv.size() && argv[pos] == "!")
+      {
+        ++pos;
+        return !parse_not();
+      }
+      return parse_primary();
+    }
+
+    bool parse_primary()
+    {
+      if (pos + 2 < argv.size() && is_binary(argv[pos + 1]))
+      {
+        auto lhs = next();
+        auto op = next();
+        return binary(lhs, op, next());
+      }
+      if (pos < argv.size() && argv[pos] == "(")
+      {
+        ++pos;
+        bool ret = parse_or();
+        if (next() != ")")
+          fail("')' expected");
+        return ret;
+      }
+      if (pos + 1 < argv.size() && is_unary(argv[pos]))
+      {
+        auto op = next();
+        return unary(op, next());
+      }
+      return !next().empty();
+    }
+
+    long long to_integer(std::string_view str)
+    {
+      std::string arg{str};
+      char *end = nullptr;
+      errno = 0;
+      long long value = std::strtoll(arg.c_str(), &end, 10);
+      while (end != nullptr && *end != '\0' && std::isspace(static_cast<unsigned char>(*end))) ++end;
+      if (arg.empty() || *end != '\0' || errno == ERANGE)
+        fail(fmt::format("{}: integer expression expected", str));
+      return value;
+    }
+
+    bool unary(std::string_view op, std::string_view operand)
+    {
+      std::string path{operand};
+      struct stat st;
+      switch (op[1])
+      {
+        case 'n':
+          return !operand.empty();
+        case 'z':
+          return operand.empty();
+        case 't':
+          return isatty(static_cast<int>(to_integer(operand)));
+        case 'h':
+        case 'L':
+          return lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        case 'r':
+          return faccessat(AT_FDCWD, path.c_str(), R_OK, AT_EACCESS) == 0;
+        case 'w':
+          return faccessat(AT_FDCWD, path.c_str(), W_OK, AT_EACCESS) == 0;
+        case 'x':
+          return faccessat(AT_FDCWD, path.c_str(), X_OK, AT_EACCESS) == 0;
+        default:
+          break;
+      }
+      if (stat(path.c_str(), &st) != 0)
+        return false;
+      switch (op[1])
+      {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'G': return st.st_gid == getegid();
+        case 'O': return st.st_uid == geteuid();
+        default: return false;
+      }
+    }
+
+    bool binary(std::string_view lhs, std::string_view op, std::string_view rhs)
+    {
+      if (op == "=" || op == "==") return lhs == rhs;
+      if (op == "!=") return lhs != rhs;
+      if (op == "<") return lhs < rhs;
+      if (op == ">") return lhs > rhs;
+      if (op == "-nt" || op == "-ot" || op == "-ef")
+      {
+        struct stat a, b;
+        bool has_a = stat(std::string{lhs}.c_str(), &a) == 0;
+        bool has_b = stat(std::string{rhs}.c_str(), &b) == 0;
+        auto mtime = [](const struct stat &st) { return std::make_pair(st.st_mtim.tv_sec, st.st_mtim.tv_nsec); };
+        if (op == "-nt") return has_a && (!has_b || mtime(a) > mtime(b));
+        if (op == "-ot") return has_b && (!has_a || mtime(a) < mtime(b));
+        return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+      }
+      auto a = to_integer(lhs);
+      auto b = to_integer(rhs);
+      if (op == "-eq") return a == b;
+      if (op == "-ne") return a != b;
+      if (op == "-lt") return a < b;
+      if (op == "-le") return a <= b;
+      if (op == "-gt") return a > b;
+      return a >= b;// -ge
+    }
+  };
+
+  int native_test(Args args)
+  {
+    std::vector<std::string_view> argv;
+    argv.reserve(args.size());
+    for (std::size_t i = 1; i < args.size(); ++i)
+      argv.emplace_back(args[i].data(), args[i].size());
+    if (args[0] == "[")
+    {
+      if (argv.empty() || argv.back() != "]")
+      {
+        fmt::println(stderr, "[: missing ']'");
+        return 2;
+      }
+      argv.pop_back();
+    }
+    return TestExpression{std::move(argv)}.evaluate();
+  }
+
+  // cat file..., only for regular files, see native_supports
+  int native_cat(Args args)
+  {
+    std::fflush(stdout);
+    int ret = 0;
+    std::vector<char> buffer;
+    for (std::size_t i = 1; i < args.size(); ++i)
+    {
+      if (args[i] == "-u")
+        continue;
+      int fd = open(args[i].c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+      {
+        fmt::println(stderr, "cat: {}: {}", args[i], strerror(errno));
+        ret = 1;
+        continue;
+      }
+      // sendfile copies in the kernel, it fails with EINVAL if stdout does not support it
+      ssize_t n;
+      bool copied = false;
+      while ((n = sendfile(STDOUT_FILENO, fd, nullptr, 1 << 30)) > 0)
+        copied = true;
+      if (n == -1 && !copied && (errno == EINVAL || errno == ENOSYS))
+      {
+        buffer.resize(128 * 1024);
+        while ((n = read(fd, buffer.data(), buffer.size())) > 0)
+        {
+          if (job::write_all(STDOUT_FILENO, {buffer.data(), static_cast<std::size_t>(n)}) == -1)
+          {
+            n = -1;
+            break;
+          }
+        }
+      }
+      if (n == -1)
+      {
+        fmt::println(stderr, "cat: {}: {}", args[i], strerror(errno));
+        ret = 1;
+      }
+      close(fd);
+    }
+    return ret;
+  }
+
+  bool native_supports(Args args, const struct stat *out)
+  {
+    if (args[0] != "cat")
+      return true;
+    // Reading stdin or a device, or writing a large file to a terminal or a device, in dish
+    // could not be interrupted. /dev/null never blocks.
+    if (args.size() < 2 || out == nullptr ||
+        !(S_ISREG(out->st_mode) || S_ISFIFO(out->st_mode) || (S_ISCHR(out->st_mode) && out->st_rdev == makedev(1, 3))))
+      return false;
+    for (std::size_t i = 1; i < args.size(); ++i)
+    {
+      struct stat st;
+      if (args[i] == "-u")
+        continue;
+      if (args[i].empty() || args[i][0] == '-' || stat(args[i].c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    }
+    return true;
+  }
+
+  bool prefer_external(const String &name)
+  {
+    sol::object value = dish_context.lua_state["dish"]["prefer_external"];
+    if (value.get_type() == sol::type::boolean)
+      return value.as<bool>();
+    if (value.get_type() == sol::type::table)
+    {
+      for (auto &r: value.as<sol::table>())
+      {
+        if (r.second.get_type() == sol::type::string && r.second.as<std::string>() == name.cpp_str())
+          return true;
+      }
+    }
+    return false;
+  }
+}// namespace dish::builtin
@@ -13,118 +13,732 @@
 //   limitations under the License.
 
 #include "dish/parser.hpp"
+#include "dish/ast.hpp"
+#include "dish/interpreter.hpp"
 #include "dish/job.hpp"
 #include "dish/lexer.hpp"
 #include "dish/utils.hpp"
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dish::parser
 {
-  Parser::Parser(const String &cmd, std::vector<lexer::Token> tokens_) : command(cmd), tokens(tokens_), pos(0) {}
+  AliasTable alias_table;
+  ParseCache parse_cache{256};
 
-  int Parser::parse()
+  int AliasTable::set(const std::string &name, std::string_view value)
   {
-    pos = 0;
-    while (pos < tokens.size())
+    auto &alias = aliases[name];
+    alias.source = value;
+    alias.tokens = lexer::Lexer(std::string_view{alias.source}).get_all_tokens_no_check();
+    if (!alias.tokens.empty() && alias.tokens.back().get_type() == lexer::TokenType::end)
+      alias.tokens.pop_back();
+    ++generation;
+    for (auto &t: alias.tokens)
     {
-      if (parse_cmd(command) == -1) return -1;
+      if (t.get_type() == lexer::TokenType::error)
+      {
+        fmt::println(stderr, "alias: {}: {}", name, t.get_error());
+        aliases.erase(name);
+        return -1;
+      }
     }
+    if (alias.tokens.empty())
+      aliases.erase(name);
     return 0;
   }
 
-  job::Job Parser::get_cmd() const { return command; }
+  void AliasTable::erase(const std::string &name)
+  {
+    aliases.erase(name);
+    ++generation;
+  }
 
-  int Parser::parse_cmd(job::Job &cmd)
+  void AliasTable::clear()
   {
-    auto add_scmd = [&cmd, this]() {
-      job::Process scmd;
-      while (pos < tokens.size() && (tokens[pos].get_type() == lexer::TokenType::word ||
-                                     tokens[pos].get_type() == lexer::TokenType::env_var)) {
-        auto content = tokens[pos++].get_content();
-        if (content.starts_with('"') && content.back() == '"' && content.size() > 2)
-          content = content.substr(1, content.size() - 2);
+    aliases.clear();
+    ++generation;
+  }
 
-        // Substitute alias
-        if (scmd.empty())
-        {
-          auto it = dish_context.lua_state["dish"]["alias"][content.cpp_str()];
-          if (it.valid())
+  const Alias *AliasTable::find(const std::string &name) const
+  {
+    if (auto it = aliases.find(name); it != aliases.end())
+      return &it->second;
+    return nullptr;
+  }
+
+  std::size_t AliasTable::get_generation() const { return generation; }
+
+  std::vector<std::pair<std::string, std::string>> AliasTable::list() const
+  {
+    std::vector<std::pair<std::string, std::string>> ret;
+    for (auto &r: aliases)
+      ret.emplace_back(r.first, r.second.source);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  }
+
+  bool is_redirect(lexer::TokenType type)
+  {
+    switch (type)
+    {
+      case lexer::TokenType::lt:      //<
+      case lexer::TokenType::rt:      //>
+      case lexer::TokenType::lt_lt:   //<<
+      case lexer::TokenType::lt_lt_lt://<<<
+      case lexer::TokenType::rt_rt:   //>>
+      case lexer::TokenType::lt_and:  //<&
+      case lexer::TokenType::rt_and:  //>&
+      case lexer::TokenType::lt_rt:   //<>
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool is_word(const lexer::Token *t)
+  {
+    return t != nullptr && (t->get_type() == lexer::TokenType::word ||
+                            t->get_type() == lexer::TokenType::env_var);
+  }
+
+  bool is_keyword(const lexer::Token *t, std::string_view keyword)
+  {
+    return t != nullptr && t->get_type() == lexer::TokenType::word && t->get_content() == keyword;
+  }
+
+  bool is_keyword_prefix(const lexer::Token *t, std::string_view prefix)
+  {
+    return t != nullptr && t->get_type() == lexer::TokenType::word && t->get_content().size() > prefix.size() &&
+           t->get_content().substr(0, prefix.size()) == prefix;
+  }
+
+  // Any key=value but pipe_size=, or the name of an option without its value. An invalid one is
+  // reported by the interpreter, e.g. on spread true.
+  bool is_placement_option(const lexer::Token *t)
+  {
+    static constexpr std::string_view options[]{"cpus", "nice", "io", "spread", "memory", "cpu", "pids"};
+    if (t == nullptr || t->get_type() != lexer::TokenType::word || is_keyword_prefix(t, "pipe_size="))
+      return false;
+    auto eq = t->get_content().find('=');
+    if (eq != std::string_view::npos)
+      return eq != 0;
+    return std::any_of(std::begin(options), std::end(options), [t](auto k) { return is_keyword(t, k); });
+  }
+
+  // 'in' is only reserved after 'for' and 'case'.
+  bool is_reserved_word(const lexer::Token *t)
+  {
+    static constexpr std::string_view reserved[]{"if", "then", "elif", "else", "fi", "for", "do",
+                                                 "done", "while", "until", "case", "esac", "{", "}"};
+    return std::any_of(std::begin(reserved), std::end(reserved), [t](auto k) { return is_keyword(t, k); });
+  }
+
+  Parser::Parser(ast::Arena &arena_, std::string_view source_, const std::pmr::vector<lexer::Token> &tokens)
+      : arena(arena_), source(source_)
+  {
+    frames.emplace_back(TokenFrame{tokens.data(), tokens.data() + tokens.size(), {}});
+  }
+
+  const ast::Node *Parser::parse()
+  {
+    auto list = parse_list();
+    if (list == nullptr) return nullptr;
+    if (auto t = peek(); t != nullptr)
+    {
+      fmt::println(stderr, "Syntax Error: Unexpected '{}'.", t->get_content());
+      return nullptr;
+    }
+    // e.g. a << in an alias
+    if (!heredocs.empty())
+    {
+      fmt::println(stderr, "Syntax Error: Here-document has no body.");
+      return nullptr;
+    }
+    return list;
+  }
+
+  ast::List *Parser::parse_list(std::initializer_list<std::string_view> terminators)
+  {
+    auto list = arena.make<ast::List>();
+    auto connector = ast::Connector::seq;
+    while (auto t = peek())
+    {
+      if (t->get_type() == lexer::TokenType::newline)
+      {
+        advance();
+        continue;
+      }
+      if (t->get_type() == lexer::TokenType::dsemi ||
+          std::any_of(terminators.begin(), terminators.end(), [t](auto k) { return is_keyword(t, k); }))
+        break;
+      auto node = parse_pipeline();
+      if (node == nullptr) return nullptr;
+      list->items.emplace_back(ast::ListItem{connector, node});
+      connector = ast::Connector::seq;
+
+      t = peek();
+      if (t == nullptr) break;
+      switch (t->get_type())
+      {
+        case lexer::TokenType::background:
+          if (node->type != ast::NodeType::pipeline)
           {
-            tokens.erase(tokens.begin() + pos - 1);
-            auto alias = lexer::Lexer(it.get<std::string>()).get_all_tokens_no_check();
-            content = alias[0].get_content();
-            tokens.insert(tokens.begin() + pos - 1, std::make_move_iterator(alias.begin()),
-                          std::make_move_iterator(alias.end()));
+            fmt::println(stderr, "Syntax Error: A compound command can not be run in background.");
+            return nullptr;
           }
+          static_cast<ast::Pipeline *>(node)->background = true;
+          break;
+        case lexer::TokenType::semicolon:
+        case lexer::TokenType::newline:
+          break;
+        case lexer::TokenType::and_and:
+          connector = ast::Connector::and_and;
+          break;
+        case lexer::TokenType::or_or:
+          connector = ast::Connector::or_or;
+          break;
+        default:
+          return list;
+      }
+      advance();
+    }
+    if (connector != ast::Connector::seq)
+    {
+      if (auto t = peek(); t != nullptr)
+        fmt::println(stderr, "Syntax Error: Unexpected '{}'.", t->get_content());
+      else
+        fmt::println(stderr, "Syntax Error: Unexpected end.");
+      return nullptr;
+    }
+    return list;
+  }
+
+  ast::Node *Parser::parse_pipeline()
+  {
+    // 'time' is only a keyword before a command, e.g. time make | tail
+    bool timed = false;
+    if (is_keyword(peek(), "time") && is_word(peek_next()))
+    {
+      advance();
+      timed = true;
+    }
+    // 'on' is only a keyword before its options, e.g. on cpus=4-7 nice=10 memory=2G make | tail
+    std::vector<std::string_view> placement;
+    if (is_keyword(peek(), "on") && is_placement_option(peek_next()))
+    {
+      advance();
+      while (is_placement_option(peek()))
+      {
+        placement.emplace_back(peek()->get_content());
+        advance();
+      }
+    }
+    // pipe_size=SIZE sets the size of the pipes of this pipeline, e.g. pipe_size=1M zcat log | sort
+    std::string_view pipe_size;
+    if (is_keyword_prefix(peek(), "pipe_size=") && is_word(peek_next()))
+    {
+      pipe_size = peek()->get_content().substr(std::string_view{"pipe_size="}.size());
+      advance();
+    }
+    auto begin = line_pos();
+    if (auto next = peek_next(); is_word(peek()) && next != nullptr && next->get_type() == lexer::TokenType::lparen)
+      return parse_function();
+    if (expand_alias() == -1) return nullptr;
+    if (is_reserved_word(peek()))
+    {
+      if (timed)
+      {
+        fmt::println(stderr, "Syntax Error: 'time' can only be used with a pipeline.");
+        return nullptr;
+      }
+      if (!pipe_size.empty())
+      {
+        fmt::println(stderr, "Syntax Error: 'pipe_size=' can only be used with a pipeline.");
+        return nullptr;
+      }
+      if (!placement.empty())
+      {
+        fmt::println(stderr, "Syntax Error: 'on' can only be used with a pipeline.");
+        return nullptr;
+      }
+      return parse_compound();
+    }
+
+    auto pipeline = arena.make<ast::Pipeline>();
+    pipeline->timed = timed;
+    pipeline->pipe_size = pipe_size;
+    pipeline->placement.assign(placement.begin(), placement.end());
+    while (true)
+    {
+      auto cmd = parse_command();
+      if (cmd == nullptr) return nullptr;
+      pipeline->commands.emplace_back(cmd);
+      if (parse_redirects(*pipeline) == -1) return nullptr;
+      if (peek() == nullptr || peek()->get_type() != lexer::TokenType::pipe)
+        break;
+      advance();
+      if (expand_alias() == -1) return nullptr;
+    }
+
+    auto end = (std::max)(line_pos(), begin);
+    while (end > begin && source[end - 1] == ' ') --end;
+    pipeline->text = source.substr(begin, end - begin);
+    return pipeline;
+  }
+
+  int Parser::parse_redirects(ast::Pipeline &pipeline)
+  {
+    for (auto t = peek(); t != nullptr && is_redirect(t->get_type()); t = peek())
+    {
+      advance();
+      // the target is expanded like the words of a command, e.g. > $HOME/out
+      auto target = peek();
+      if (!is_word(target))
+      {
+        fmt::println(stderr, "Syntax Error: Expected a file after '{}'.", t->get_content());
+        return -1;
+      }
+      ast::Redirect redirect{t->get_type(), {}, false, -1, false, pipeline.commands.size() - 1};
+      auto op = t->get_content();
+      if (op[0] == '&')
+        redirect.with_stderr = true;
+      else if (std::isdigit(static_cast<unsigned char>(op[0])))
+      {
+        auto digits = op.substr(0, op.find_first_of("<>"));
+        if (digits.size() > 4)
+        {
+          fmt::println(stderr, "Syntax Error: Bad file descriptor '{}'.", digits);
+          return -1;
         }
+        redirect.fd = std::stoi(std::string{digits});
+      }
+      if (t->get_type() == lexer::TokenType::lt_lt)
+      {
+        // the body is filled in by peek()
+        auto delimiter = target->get_content();
+        redirect.quoted = delimiter.find_first_of("\"'") != std::string_view::npos;
+        heredocs.emplace_back(&pipeline, pipeline.redirects.size());
+      }
+      else
+        redirect.target = arena.copy(target->get_content());
+      pipeline.redirects.emplace_back(redirect);
+      advance();
+    }
+    return 0;
+  }
+
+  ast::Command *Parser::parse_command()
+  {
+    auto cmd = arena.make<ast::Command>();
+    for (auto t = peek(); is_word(t); t = peek())
+    {
+      cmd->words.emplace_back(make_word(*t));
+      advance();
+    }
+    if (cmd->words.empty())
+    {
+      if (auto t = peek(); t != nullptr)
+        fmt::println(stderr, "Syntax Error: Unexpected '{}'.", t->get_content());
+      else
+        fmt::println(stderr, "Syntax Error: Unexpected end.");
+      return nullptr;
+    }
+    return cmd;
+  }
+
+  ast::IfClause *Parser::parse_if()
+  {
+    auto node = arena.make<ast::IfClause>();
+    do
+    {
+      advance();// 'if' or 'elif'
+      auto cond = parse_list({"then"});
+      if (cond == nullptr || expect("then") == -1) return nullptr;
+      auto body = parse_list({"elif", "else", "fi"});
+      if (body == nullptr) return nullptr;
+      node->branches.emplace_back(ast::IfBranch{cond, body});
+    } while (is_keyword(peek(), "elif"));
+    if (is_keyword(peek(), "else"))
+    {
+      advance();
+      if ((node->else_body = parse_list({"fi"})) == nullptr) return nullptr;
+    }
+    if (expect("fi") == -1) return nullptr;
+    return node;
+  }
 
-        // glob and ~
-        if (tokens[pos - 1].get_type() == lexer::TokenType::word)
+  ast::ForClause *Parser::parse_for()
+  {
+    auto node = arena.make<ast::ForClause>();
+    advance();// 'for'
+    auto name = peek();
+    if (name == nullptr || name->get_type() != lexer::TokenType::word)
+    {
+      fmt::println(stderr, "Syntax Error: Expected a variable name after 'for'.");
+      return nullptr;
+    }
+    node->name = arena.copy(name->get_content());
+    advance();
+    if (is_keyword(peek(), "in"))
+    {
+      advance();
+      for (auto t = peek(); is_word(t); t = peek())
+      {
+        node->words.emplace_back(make_word(*t));
+        advance();
+      }
+    }
+    else
+      node->positional = true;
+    if (auto t = peek(); t != nullptr && t->get_type() == lexer::TokenType::semicolon)
+      advance();
+    skip_newlines();
+    if (expect("do") == -1) return nullptr;
+    if ((node->body = parse_list({"done"})) == nullptr || expect("done") == -1) return nullptr;
+    return node;
+  }
+
+  ast::WhileClause *Parser::parse_while()
+  {
+    auto node = arena.make<ast::WhileClause>();
+    node->until = is_keyword(peek(), "until");
+    advance();// 'while' or 'until'
+    if ((node->cond = parse_list({"do"})) == nullptr || expect("do") == -1) return nullptr;
+    if ((node->body = parse_list({"done"})) == nullptr || expect("done") == -1) return nullptr;
+    return node;
+  }
+
+  ast::CaseClause *Parser::parse_case()
+  {
+    auto node = arena.make<ast::CaseClause>();
+    advance();// 'case'
+    auto word = peek();
+    if (!is_word(word))
+    {
+      fmt::println(stderr, "Syntax Error: Expected a word after 'case'.");
+      return nullptr;
+    }
+    node->word = make_word(*word);
+    advance();
+    skip_newlines();
+    if (expect("in") == -1) return nullptr;
+    while (true)
+    {
+      skip_newlines();
+      if (is_keyword(peek(), "esac"))
+      {
+        advance();
+        return node;
+      }
+      auto item = arena.make<ast::CaseItem>();
+      while (true)
+      {
+        auto t = peek();
+        if (!is_word(t))
         {
-          auto expanded = utils::expand(content);
-          for (auto &r: expanded)
-            scmd.insert(r);
+          fmt::println(stderr, "Syntax Error: Expected a pattern or 'esac'.");
+          return nullptr;
         }
-        // environment variable
-        else if (tokens[pos - 1].get_type() == lexer::TokenType::env_var)
-          scmd.insert(utils::get_dish_env(content));
-        else
-          scmd.insert(content);
+        item->patterns.emplace_back(make_word(*t));
+        advance();
+        if (peek() == nullptr || peek()->get_type() != lexer::TokenType::pipe)
+          break;
+        advance();
       }
-      cmd.insert(scmd);
+      if (peek() == nullptr || peek()->get_type() != lexer::TokenType::rparen)
+      {
+        fmt::println(stderr, "Syntax Error: Expected ')' after a pattern.");
+        return nullptr;
+      }
+      advance();
+      if ((item->body = parse_list({"esac"})) == nullptr) return nullptr;
+      node->items.emplace_back(item);
+      if (peek() != nullptr && peek()->get_type() == lexer::TokenType::dsemi)
+        advance();
+      else if (!is_keyword(peek(), "esac"))
+      {
+        fmt::println(stderr, "Syntax Error: Expected ';;' or 'esac'.");
+        return nullptr;
+      }
+    }
+  }
+
+  ast::List *Parser::parse_group()
+  {
+    advance();// '{'
+    auto list = parse_list({"}"});
+    if (list == nullptr || expect("}") == -1) return nullptr;
+    return list;
+  }
+
+  ast::Node *Parser::parse_compound()
+  {
+    auto keyword = peek()->get_content();
+    if (keyword == "if")
+      return parse_if();
+    else if (keyword == "for")
+      return parse_for();
+    else if (keyword == "while" || keyword == "until")
+      return parse_while();
+    else if (keyword == "case")
+      return parse_case();
+    else if (keyword == "{")
+      return parse_group();
+    fmt::println(stderr, "Syntax Error: Unexpected '{}'.", keyword);
+    return nullptr;
+  }
+
+  ast::FunctionDef *Parser::parse_function()
+  {
+    auto node = arena.make<ast::FunctionDef>();
+    auto name = peek();
+    if (name->get_type() != lexer::TokenType::word || is_reserved_word(name))
+    {
+      fmt::println(stderr, "Syntax Error: Invalid function name '{}'.", name->get_content());
+      return nullptr;
+    }
+    node->name = arena.copy(name->get_content());
+    advance();
+    advance();// '('
+    if (peek() == nullptr || peek()->get_type() != lexer::TokenType::rparen)
+    {
+      fmt::println(stderr, "Syntax Error: Expected ')' after '('.");
+      return nullptr;
+    }
+    advance();
+    skip_newlines();
+    if (!is_reserved_word(peek()))
+    {
+      fmt::println(stderr, "Syntax Error: Expected a compound command as the body of '{}'.", node->name);
+      return nullptr;
+    }
+    if ((node->body = parse_compound()) == nullptr) return nullptr;
+    return node;
+  }
+
+  // Quotes are kept, they are removed by expansion::expand.
+  ast::Word Parser::make_word(const lexer::Token &token)
+  {
+    return ast::Word{token.get_type(), arena.copy(token.get_content())};
+  }
+
+  int Parser::expect(std::string_view keyword)
+  {
+    auto t = peek();
+    if (is_keyword(t, keyword))
+    {
+      advance();
       return 0;
-    };
-    if (add_scmd() == -1) return -1;
-    while (pos < tokens.size() && tokens[pos].get_type() == lexer::TokenType::pipe)
+    }
+    if (t == nullptr)
+      fmt::println(stderr, "Syntax Error: Expected '{}' but got end.", keyword);
+    else
+      fmt::println(stderr, "Syntax Error: Expected '{}' but got '{}'.", keyword, t->get_content());
+    return -1;
+  }
+
+  void Parser::skip_newlines()
+  {
+    for (auto t = peek(); t != nullptr && t->get_type() == lexer::TokenType::newline; t = peek())
+      advance();
+  }
+
+  const lexer::Token *Parser::peek()
+  {
+    while (true)
     {
-      ++pos;
-      if (add_scmd() == -1) return -1;
+      while (!frames.empty() && frames.back().curr == frames.back().end)
+        frames.pop_back();
+      if (frames.empty()) return nullptr;
+      auto t = frames.back().curr;
+      if (t->get_type() != lexer::TokenType::heredoc)
+        return t;
+      if (!heredocs.empty())
+      {
+        auto [pipeline, index] = heredocs.front();
+        // heredoc tokens are spans of the line, which is in the arena already
+        pipeline->redirects[index].target = t->get_content();
+        heredocs.erase(heredocs.begin());
+      }
+      ++frames.back().curr;
     }
+  }
+
+  const lexer::Token *Parser::peek_next()
+  {
+    if (peek() == nullptr || frames.back().curr + 1 == frames.back().end)
+      return nullptr;
+    return frames.back().curr + 1;
+  }
 
-    while (pos < tokens.size())
+  void Parser::advance()
+  {
+    if (peek() != nullptr)
+      ++frames.back().curr;
+  }
+
+  std::size_t Parser::line_pos() const
+  {
+    // The line's own frame is at the bottom, it is popped only when everything is consumed.
+    if (frames.empty() || frames.front().curr == frames.front().end)
+      return source.size();
+    return frames.front().curr->get_pos();
+  }
+
+  // Substitutes the alias of the first word recursively. An alias whose tokens are still on the
+  // stack is not expanded again, so 'ls' -> 'ls --color=tty' stops, and so does 'a' -> 'b; a'
+  // when its second command is parsed.
+  int Parser::expand_alias()
+  {
+    while (true)
     {
-      switch (tokens[pos].get_type())
+      auto t = peek();
+      if (t == nullptr || t->get_type() != lexer::TokenType::word)
+        return 0;
+      auto name = t->get_content();
+      auto alias = alias_table.find(std::string{name});
+      if (alias == nullptr || std::any_of(frames.cbegin(), frames.cend(), [name](auto &f) { return f.alias == name; }))
+        return 0;
+      // the line's own frame is not an alias
+      if (frames.size() > max_alias_depth)
       {
-        case lexer::TokenType::lt://<
-          cmd.set_in(job::Redirect{job::RedirectType::input, tokens[pos + 1].get_content()});
-          pos += 2;
-          break;
-        case lexer::TokenType::rt://>
-          cmd.set_out(job::Redirect{job::RedirectType::overwrite, tokens[pos + 1].get_content()});
-          pos += 2;
-          break;
-        case lexer::TokenType::lt_lt://<<
-          fmt::println("TODO");
-          pos += 2;
-          break;
-        case lexer::TokenType::lt_lt_lt://<<<
-          fmt::println("TODO");
-          pos += 2;
+        fmt::println(stderr, "dish: alias: expansion of '{}' is nested too deeply.", frames[1].alias);
+        return -1;
+      }
+      advance();
+      frames.emplace_back(TokenFrame{alias->tokens.data(), alias->tokens.data() + alias->tokens.size(), name});
+    }
+    return 0;
+  }
+
+  std::shared_ptr<const ast::Tree> parse(const String &line)
+  {
+    auto tree = std::make_shared<ast::Tree>();
+    auto &arena = tree->get_arena();
+    tree->set_source(utils::to_view(line));
+    auto tokens = lexer::Lexer{tree->get_source()}.get_all_tokens(arena.get_resource());
+    if (!tokens.has_value()) return nullptr;
+    Parser parser{arena, tree->get_source(), *tokens};
+    auto root = parser.parse();
+    if (root == nullptr) return nullptr;
+    tree->set_root(root);
+    return tree;
+  }
+
+  bool CompletenessChecker::is_complete(std::string_view source)
+  {
+    lexer::Lexer lexer{source};
+    lexer.seek(checkpoint);
+    auto curr_depth = depth;
+    auto curr_connector = connector;
+    bool command_position = true;
+    for (auto t = lexer.get_token(); t.get_type() != lexer::TokenType::end; t = lexer.get_token())
+    {
+      // a newline after '&&' or '||' does not end the list
+      if (t.get_type() != lexer::TokenType::newline && t.get_type() != lexer::TokenType::heredoc)
+        curr_connector = false;
+      switch (t.get_type())
+      {
+        case lexer::TokenType::error:
+          // an unterminated quote, ${ or $( runs to the end
+          return t.get_pos() + t.get_content().size() != source.size();
+        case lexer::TokenType::heredoc:
           break;
-        case lexer::TokenType::rt_rt://>>
-          cmd.set_out(job::Redirect{job::RedirectType::append, tokens[pos + 1].get_content()});
-          pos += 2;
+        case lexer::TokenType::word:
+        {
+          if (!command_position)
+            break;
+          auto word = t.get_content();
+          if (word == "if" || word == "for" || word == "while" || word == "until" || word == "case" || word == "{")
+            ++curr_depth;
+          else if (curr_depth != 0 && (word == "fi" || word == "done" || word == "esac" || word == "}"))
+            --curr_depth;
+          command_position = word == "if" || word == "then" || word == "elif" || word == "else" || word == "do" ||
+                             word == "while" || word == "until" || word == "{";
           break;
-        case lexer::TokenType::lt_and://<&
-          cmd.set_in(job::Redirect{job::RedirectType::fd, std::stoi(tokens[pos + 1].get_content().cpp_str())});
-          pos += 2;
+        }
+        case lexer::TokenType::and_and:
+        case lexer::TokenType::or_or:
+          curr_connector = true;
+          command_position = true;
           break;
-        case lexer::TokenType::rt_and://>&
-          cmd.set_out(job::Redirect{job::RedirectType::fd, std::stoi(tokens[pos + 1].get_content().cpp_str())});
-          pos += 2;
+        case lexer::TokenType::newline:
+          // nothing before it needs to be lexed again
+          if (!lexer.has_open_heredoc())
+          {
+            checkpoint = t.get_pos() + 1;
+            depth = curr_depth;
+            connector = curr_connector;
+          }
+          command_position = true;
           break;
-        case lexer::TokenType::lt_rt://<>
-          fmt::println("TODO");
-          pos += 2;
+        case lexer::TokenType::semicolon:
+        case lexer::TokenType::dsemi:
+        case lexer::TokenType::background:
+        case lexer::TokenType::pipe:
+        case lexer::TokenType::lparen:
+        case lexer::TokenType::rparen:
+          command_position = true;
           break;
-        case lexer::TokenType::background://&
-          cmd.set_background();
-          pos++;
+        default:
+          command_position = false;
           break;
       }
     }
-    return 0;
+    return curr_depth == 0 && !curr_connector && !lexer.has_open_heredoc();
+  }
+
+  void CompletenessChecker::reset()
+  {
+    checkpoint = 0;
+    depth = 0;
+    connector = false;
+  }
+
+  std::shared_ptr<const interpreter::Program> ParseCache::get(const String &line)
+  {
+    if (auto it = index.find(line); it != index.end())
+    {
+      if (it->second->generation == alias_table.get_generation())
+      {
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->program;
+      }
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    ++misses;
+
+    auto tree = parse(line);
+    if (tree == nullptr) return nullptr;
+    auto program = interpreter::compile(std::move(tree));
+
+    if (capacity == 0) return program;
+    if (entries.size() >= capacity)
+    {
+      index.erase(entries.back().line);
+      entries.pop_back();
+    }
+    entries.emplace_front(Entry{line, alias_table.get_generation(), program});
+    index.emplace(line, entries.begin());
+    return program;
   }
-}// namespace dish::parser
\ No newline at end of file
+
+  void ParseCache::clear()
+  {
+    entries.clear();
+    index.clear();
+  }
+
+  std::size_t ParseCache::get_hits() const { return hits; }
+
+  std::size_t ParseCache::get_misses() const { return misses; }
+
+  std::size_t ParseCache::size() const { return entries.size(); }
+}// namespace dish::parser
@@ -0,0 +1,139 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/script.hpp"
+#include "dish/dish.hpp"
+#include "dish/parser.hpp"
+#include "dish/utils.hpp"
+#include "dish/variable.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace dish::script
+{
+  std::size_t run_commands(std::string_view text, bool eof, parser::CompletenessChecker &checker)
+  {
+    std::size_t done = 0;
+    auto run = [&done, &checker, text](std::size_t end) {
+      auto command = text.substr(done, end - done);
+      done = end;
+      checker.reset();
+      if (command.find_first_not_of(" \t\n") != std::string_view::npos)
+        run_command(utils::to_string(command));
+    };
+    for (auto nl = text.find('\n'); nl != std::string_view::npos && dish_context.running; nl = text.find('\n', nl + 1))
+    {
+      if (checker.is_complete(text.substr(done, nl + 1 - done)))
+        run(nl + 1);
+    }
+    if (eof && done < text.size() && dish_context.running)
+      run(text.size());
+    return done;
+  }
+
+  int run_string(std::string_view source)
+  {
+    parser::CompletenessChecker checker;
+    run_commands(source, true, checker);
+    return variable::variable_table.get_last_status();
+  }
+
+  // A regular file of size bytes
+  int run_mapped(int fd, std::size_t size)
+  {
+    if (size == 0)
+      return 0;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      fmt::println(stderr, "dish: mmap: {}", strerror(errno));
+      return 1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    std::string_view source{static_cast<const char *>(data), size};
+    // #!/path/to/dish
+    if (source.compare(0, 2, "#!") == 0)
+      source.remove_prefix((std::min)(source.find('\n'), source.size()));
+    int ret = run_string(source);
+    munmap(data, size);
+    return ret;
+  }
+
+  int run_file(const char *path)
+  {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      fmt::println(stderr, "dish: {}: {}", path, strerror(errno));
+      return 127;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+      fmt::println(stderr, "dish: {}: Not a regular file.", path);
+      close(fd);
+      return 126;
+    }
+    int ret = run_mapped(fd, static_cast<std::size_t>(st.st_size));
+    close(fd);
+    return ret;
+  }
+
+  int run_stream(int fd)
+  {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+      return run_mapped(fd, static_cast<std::size_t>(st.st_size));
+
+    // The commands of a pipe are read ahead, so a command reading stdin does not see them.
+    constexpr std::size_t block = 64 * 1024;
+    std::string buffer;
+    std::size_t begin = 0;
+    parser::CompletenessChecker checker;
+    while (dish_context.running)
+    {
+      auto size = buffer.size();
+      buffer.resize(size + block);
+      auto n = read(fd, buffer.data() + size, block);
+      if (n == -1 && errno == EINTR)
+      {
+        buffer.resize(size);
+        continue;
+      }
+      buffer.resize(size + (n > 0 ? n : 0));
+      if (n == -1)
+        fmt::println(stderr, "dish: read: {}", strerror(errno));
+      bool eof = n <= 0;
+      begin += run_commands(std::string_view{buffer}.substr(begin), eof, checker);
+      if (eof)
+        break;
+      // drop the commands that have been run once they take half of the buffer
+      if (begin > buffer.size() / 2)
+      {
+        buffer.erase(0, begin);
+        begin = 0;
+      }
+    }
+    return variable::variable_table.get_last_status();
+  }
+}// namespace dish::script
@@ -15,20 +15,13 @@
 #include "dish/token.hpp"
 
 #include <string>
+#include <string_view>
 
 namespace dish::lexer
 {
   TokenType Token::get_type() const { return type; }
-  String Token::get_content() const { return content; }
-  String Token::get_error() const { return error; }
+  std::string_view Token::get_content() const { return content; }
+  const char *Token::get_error() const { return error == nullptr ? "" : error; }
   std::size_t Token::get_pos() const { return pos; }
-  std::size_t Token::get_size() const { return size; }
-  void Token::set_content(String c)
-  {
-    content = std::move(c);
-  }
-  void Token::set_error(String c)
-  {
-    error = std::move(c);
-  }
+  std::size_t Token::get_size() const { return content.size(); }
 }// namespace dish::lexer
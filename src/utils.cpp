@@ -15,6 +15,8 @@
 #include "dish/utils.hpp"
 #include "dish/builtin.hpp"
 #include "dish/dish.hpp"
+#include "dish/interpreter.hpp"
+#include "dish/variable.hpp"
 
 #include "dish/bundled/widecharwidth/widechar_width.h"
 
@@ -23,7 +25,9 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <climits>
 #include <codecvt>
 #include <cstdio>
 #include <cstdlib>
@@ -90,8 +94,8 @@ namespace dish::utils
 
   String get_dish_env(const String &s)
   {
-    if (auto it = dish_context.lua_state["dish"]["environment"][s.cpp_str()]; it.valid())
-      return {it.get<std::string>()};
+    if (auto it = variable::variable_table.get(s.cpp_str()); it != nullptr)
+      return {*it};
     return "";
   }
   bool has_wildcards(const String &s)
@@ -106,9 +110,9 @@ namespace dish::utils
     const std::vector<String> env_to_find{"HOME", "USERPROFILE", "HOMEDRIVE", "HOMEPATH"};
     for (auto &r: env_to_find)
     {
-      if (auto it = dish_context.lua_state["dish"]["environment"][r.cpp_str()]; it.valid())
+      if (auto it = variable::variable_table.get(r.cpp_str()); it != nullptr)
       {
-        home = it.get<std::string>();
+        home = *it;
         break;
       }
     }
@@ -246,9 +250,9 @@ namespace dish::utils
     return ret;
   }
 
-  std::vector<String> expand(const String &str)
+  void expand(const String &str, std::vector<String> &out)
   {
-    if (str.empty()) return {};
+    if (str.empty()) return;
     String s = expand_tilde(str);
     if (s.empty()) s = str;
 
@@ -257,9 +261,270 @@ namespace dish::utils
     {
       auto w = expand_wildcards(s);
       if (w.has_value() && !w.value().empty())
-        return *w;
+      {
+        out.insert(out.end(), std::make_move_iterator(w->begin()), std::make_move_iterator(w->end()));
+        return;
+      }
+    }
+    out.emplace_back(std::move(s));
+  }
+
+  std::size_t find_matching_paren(std::string_view text, std::size_t pos)
+  {
+    std::size_t depth = 0;
+    for (; pos < text.size(); ++pos)
+    {
+      if (text[pos] == '"')
+      {
+        pos = text.find('"', pos + 1);
+        if (pos == std::string_view::npos)
+          break;
+      }
+      else if (text[pos] == '(')
+        ++depth;
+      else if (text[pos] == ')' && --depth == 0)
+        return pos;
+    }
+    return std::string_view::npos;
+  }
+
+  // the position after "...", ${...} or $(...) beginning at pos, or pos itself
+  std::size_t skip_quoted(std::string_view word, std::size_t pos)
+  {
+    if (word[pos] == '"')
+    {
+      auto end = word.find('"', pos + 1);
+      return end == std::string_view::npos ? word.size() : end + 1;
+    }
+    if (word[pos] == '$' && pos + 1 < word.size() && word[pos + 1] == '(')
+    {
+      auto end = find_matching_paren(word, pos + 1);
+      return end == std::string_view::npos ? word.size() : end + 1;
+    }
+    if (word[pos] == '$' && pos + 1 < word.size() && word[pos + 1] == '{')
+    {
+      std::size_t depth = 0;
+      for (auto i = pos + 1; i < word.size(); ++i)
+      {
+        if (word[i] == '{')
+          ++depth;
+        else if (word[i] == '}' && --depth == 0)
+          return i + 1;
+      }
+      return word.size();
+    }
+    return pos;
+  }
+
+  // The end of the item of a brace beginning at pos, which is a top-level ',' or the '}'.
+  // With stop_at_comma false, it is the matching '}' of the '{' at pos.
+  std::size_t find_brace_end(std::string_view word, std::size_t pos, bool stop_at_comma)
+  {
+    std::size_t depth = stop_at_comma ? 1 : 0;
+    while (pos < word.size())
+    {
+      if (auto skipped = skip_quoted(word, pos); skipped != pos)
+      {
+        pos = skipped;
+        continue;
+      }
+      if (word[pos] == '{')
+        ++depth;
+      else if (word[pos] == '}' && --depth == 0)
+        return pos;
+      else if (word[pos] == ',' && depth == 1 && stop_at_comma)
+        return pos;
+      ++pos;
+    }
+    return std::string_view::npos;
+  }
+
+  struct Range
+  {
+    bool is_char;
+    long long first;
+    long long last;
+    long long step;
+    int width;
+    unsigned long long count;
+  };
+
+  bool parse_integer(std::string_view str, long long &value)
+  {
+    if (!str.empty() && str[0] == '+') str.remove_prefix(1);
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return !str.empty() && ec == std::errc{} && end == str.data() + str.size();
+  }
+
+  // x..y or x..y..step, x and y are both integers or both letters. A step or a count of items
+  // that does not fit is not a range.
+  std::optional<Range> parse_range(std::string_view body)
+  {
+    auto dots = body.find("..");
+    if (dots == std::string_view::npos) return std::nullopt;
+    auto x = body.substr(0, dots);
+    auto y = body.substr(dots + 2);
+    long long step = 1;
+    if (auto dots2 = y.find(".."); dots2 != std::string_view::npos)
+    {
+      if (!parse_integer(y.substr(dots2 + 2), step)) return std::nullopt;
+      y = y.substr(0, dots2);
+    }
+    if (step == LLONG_MIN) return std::nullopt;
+    if (step < 0) step = -step;
+    if (step == 0) step = 1;
+    Range ret{false, 0, 0, step, 0, 0};
+    auto is_letter = [](std::string_view s) {
+      return s.size() == 1 && ((s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z'));
+    };
+    if (is_letter(x) && is_letter(y))
+    {
+      ret.is_char = true;
+      ret.first = x[0];
+      ret.last = y[0];
+    }
+    else if (parse_integer(x, ret.first) && parse_integer(y, ret.last))
+    {
+      // {01..10} is padded with zeros
+      auto padded = [](std::string_view s) {
+        if (!s.empty() && s[0] == '-') s.remove_prefix(1);
+        return s.size() > 1 && s[0] == '0';
+      };
+      if (padded(x) || padded(y))
+        ret.width = static_cast<int>((std::max)(x.size(), y.size()));
+    }
+    else
+      return std::nullopt;
+    // in unsigned arithmetic, the distance of LLONG_MIN..LLONG_MAX fits
+    auto distance = ret.first > ret.last
+                            ? static_cast<unsigned long long>(ret.first) - static_cast<unsigned long long>(ret.last)
+                            : static_cast<unsigned long long>(ret.last) - static_cast<unsigned long long>(ret.first);
+    ret.count = distance / static_cast<unsigned long long>(step);
+    if (ret.count == ULLONG_MAX) return std::nullopt;
+    ++ret.count;
+    if (ret.first > ret.last) ret.step = -ret.step;
+    return ret;
+  }
+
+  // the '{' of the first brace that can be expanded, npos if none
+  std::size_t find_brace(std::string_view word, std::size_t &close)
+  {
+    std::size_t pos = 0;
+    while (pos < word.size())
+    {
+      if (auto skipped = skip_quoted(word, pos); skipped != pos)
+      {
+        pos = skipped;
+        continue;
+      }
+      if (word[pos] == '{')
+      {
+        close = find_brace_end(word, pos, false);
+        if (close == std::string_view::npos)
+          return std::string_view::npos;
+        // a,b or x..y, {} and {a} are not expanded
+        if (find_brace_end(word, pos + 1, true) != close || parse_range(word.substr(pos + 1, close - pos - 1)).has_value())
+          return pos;
+      }
+      ++pos;
+    }
+    return std::string_view::npos;
+  }
+
+  bool has_braces(std::string_view word)
+  {
+    if (word.find('{') == std::string_view::npos) return false;
+    std::size_t close = 0;
+    return find_brace(word, close) != std::string_view::npos;
+  }
+
+  BraceExpansion::BraceExpansion(std::string_view word)
+  {
+    if (!push(std::string{word}))
+    {
+      // a word without braces is itself
+      frames.emplace_back(Frame{std::string{word}, 0, 0, 0, false, false, 0, 0, 0, 0});
+    }
+  }
+
+  bool BraceExpansion::push(std::string &&word)
+  {
+    std::size_t close = 0;
+    auto open = find_brace(word, close);
+    if (open == std::string_view::npos)
+      return false;
+    Frame frame{std::move(word), open, close, open + 1, false, false, 0, 0, 0, 0};
+    if (auto range = parse_range(std::string_view{frame.word}.substr(open + 1, close - open - 1));
+        range.has_value() && find_brace_end(frame.word, open + 1, true) == close)
+    {
+      frame.is_range = true;
+      frame.is_char = range->is_char;
+      frame.curr = range->first;
+      frame.left = range->count;
+      frame.step = range->step;
+      frame.width = range->width;
+    }
+    frames.emplace_back(std::move(frame));
+    return true;
+  }
+
+  bool BraceExpansion::next(std::string &out)
+  {
+    while (!frames.empty())
+    {
+      auto &f = frames.back();
+      // the frame of a word without braces
+      if (f.close == 0)
+      {
+        out = std::move(f.word);
+        frames.pop_back();
+        return true;
+      }
+
+      std::string_view word{f.word};
+      out.assign(word.substr(0, f.open));
+      if (f.is_range)
+      {
+        if (f.left == 0)
+        {
+          frames.pop_back();
+          continue;
+        }
+        if (f.is_char)
+          out += static_cast<char>(f.curr);
+        else
+        {
+          char buf[24];
+          // the magnitude of LLONG_MIN only fits in unsigned
+          auto mag = static_cast<unsigned long long>(f.curr);
+          auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), f.curr < 0 ? 0 - mag : mag);
+          int len = static_cast<int>(end - buf) + (f.curr < 0 ? 1 : 0);
+          if (f.curr < 0) out += '-';
+          if (len < f.width) out.append(f.width - len, '0');
+          out.append(buf, end);
+        }
+        // the last item may be the limit of long long, there is nothing after it
+        if (--f.left != 0)
+          f.curr += f.step;
+      }
+      else
+      {
+        if (f.item > f.close)
+        {
+          frames.pop_back();
+          continue;
+        }
+        auto end = find_brace_end(word, f.item, true);
+        out.append(word.substr(f.item, end - f.item));
+        f.item = end + 1;
+      }
+      out.append(word.substr(f.close + 1));
+      // e.g. {a,b}{c,d} or {a,{b,c}}
+      if (out.find('{') != std::string::npos && push(std::string{out}))
+        continue;
+      return true;
     }
-    return {s};
+    return false;
   }
 
   String get_timestamp()
@@ -275,9 +540,15 @@ namespace dish::utils
       case CommandType::not_found:
         return "not found";
         break;
+      case CommandType::function:
+        return "shell function";
+        break;
       case CommandType::builtin:
         return "builtin";
         break;
+      case CommandType::native:
+        return "native builtin";
+        break;
       case CommandType::lua_func:
         return "lua function";
         break;
@@ -294,6 +565,17 @@ namespace dish::utils
     return "";
   }
 
+  String to_string(std::string_view view)
+  {
+    // String(const char *, size_t) takes a length in codepoints.
+    return String{std::string{view}};
+  }
+
+  std::string_view to_view(const String &str)
+  {
+    return {str.c_str(), str.size()};
+  }
+
   bool operator<(const Command &a, const Command &b)
   {
     return a.name < b.name;
@@ -319,14 +601,21 @@ namespace dish::utils
   }
 
 
-  std::tuple<CommandType, String> find_command(const String &cmd)
+  std::tuple<CommandType, String> find_command(const String &cmd, bool native)
   {
+    if (interpreter::functions.find(cmd.cpp_str()) != interpreter::functions.end())
+      return {CommandType::function, cmd};
+
     if (builtin::builtins.find(cmd) != builtin::builtins.end())
       return {CommandType::builtin, cmd};
 
-    if (dish_context.lua_state["dish"]["func"][cmd.cpp_str()].valid())
+    if (dish_context.lua_functions.find(cmd.cpp_str()) != nullptr)
       return {CommandType::lua_func, cmd};
 
+    bool has_native = builtin::natives.find(cmd) != builtin::natives.end();
+    if (has_native && native && !builtin::prefer_external(cmd))
+      return {CommandType::native, cmd};
+
     try // catch exceptions such as permission denied
     {
       String abs_path;
@@ -347,7 +636,7 @@ namespace dish::utils
       }();
 
       if (!found)
-        return {CommandType::not_found, ""};
+        return {has_native ? CommandType::native : CommandType::not_found, has_native ? cmd : ""};
       if (!is_executable(abs_path.cpp_str()))
         return {CommandType::not_executable, abs_path};
       if (std::filesystem::is_symlink(std::filesystem::path(abs_path.cpp_str())))
@@ -379,6 +668,12 @@ namespace dish::utils
       cache.clear();
     if (auto it = cache.find(pattern); it != cache.end()) return it->second;
     std::set<Command> ret;
+    // function
+    for (auto &r: interpreter::functions)
+    {
+      if (begin_with(r.first, pattern))
+        ret.insert(Command{r.first, CommandType::function, 0});
+    }
     // builtin
     for (auto &r: builtin::builtins)
     {
@@ -386,9 +681,9 @@ namespace dish::utils
         ret.insert(Command{r.first, CommandType::builtin, 0});
     }
     // lua function
-    for (auto &r: dish_context.lua_state["dish"]["func"].get<sol::table>())
+    for (auto &name: dish_context.lua_functions.list())
     {
-      auto fn = String(r.first.as<std::string>());
+      auto fn = String(name);
       if (begin_with(fn, pattern))
         ret.insert(Command{fn, CommandType::lua_func, 0});
     }
@@ -482,7 +777,8 @@ namespace dish::utils
 
     if (has_wildcards(complete))
     {
-      auto expanded = expand(complete);
+      std::vector<String> expanded;
+      expand(complete, expanded);
       String pattern = expand_tilde(complete);
       for (auto &r: expanded)
       {
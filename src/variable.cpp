@@ -0,0 +1,109 @@
+//   Copyright 2022 - 2025 dish - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dish/variable.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dish::variable
+{
+  VariableTable variable_table;
+
+  const std::string *VariableTable::get(std::string_view name) const
+  {
+    if (auto it = variables.find(name); it != variables.end())
+      return &it->second;
+    return nullptr;
+  }
+
+  void VariableTable::set(std::string_view name, std::string_view value)
+  {
+    if (auto it = variables.find(name); it != variables.end())
+      it->second.assign(value);
+    else
+      variables.emplace(name, value);
+    // e.g. the variable of a for loop does not rebuild envp on each iteration
+    if (!envp_dirty && is_exported(name))
+      envp_dirty = true;
+  }
+
+  void VariableTable::export_variable(std::string_view name)
+  {
+    if (variables.find(name) == variables.end())
+      variables.emplace(name, "");
+    if (exported.find(name) == exported.end())
+    {
+      exported.emplace(name);
+      envp_dirty = true;
+    }
+  }
+
+  bool VariableTable::is_exported(std::string_view name) const { return exported.find(name) != exported.end(); }
+
+  void VariableTable::erase(std::string_view name)
+  {
+    if (auto it = variables.find(name); it != variables.end())
+      variables.erase(it);
+    if (auto it = exported.find(name); it != exported.end())
+    {
+      exported.erase(it);
+      envp_dirty = true;
+    }
+  }
+
+  void VariableTable::clear()
+  {
+    variables.clear();
+    exported.clear();
+    envp_dirty = true;
+  }
+
+  const std::map<std::string, std::string, std::less<>> &VariableTable::list() const { return variables; }
+
+  char *const *VariableTable::get_envp()
+  {
+    if (envp_dirty)
+    {
+      envp_storage.clear();
+      envp.clear();
+      for (auto &name: exported)
+        envp_storage.emplace_back(name + "=" + variables.find(name)->second);
+      for (auto &r: envp_storage)
+        envp.emplace_back(r.data());
+      envp.emplace_back(nullptr);
+      envp_dirty = false;
+    }
+    return envp.data();
+  }
+
+  void VariableTable::push_args(const std::vector<String> *args) { args_stack.emplace_back(args); }
+
+  void VariableTable::pop_args() { args_stack.pop_back(); }
+
+  const std::vector<String> *VariableTable::get_args() const
+  {
+    if (args_stack.empty()) return nullptr;
+    return args_stack.back();
+  }
+
+  std::size_t VariableTable::get_call_depth() const { return args_stack.size(); }
+
+  int VariableTable::get_last_status() const { return last_status; }
+
+  void VariableTable::set_last_status(int status) { last_status = status; }
+}// namespace dish::variable
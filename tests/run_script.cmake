@@ -0,0 +1,15 @@
+# Runs SCRIPT with DISH and compares its stdout with EXPECTED. HOME is a directory of the build
+# with an empty config.lua, so the config of the user does not change the results.
+file(WRITE ${HOME}/.config/dish/config.lua "")
+set(ENV{HOME} ${HOME})
+execute_process(COMMAND ${DISH} ${SCRIPT}
+                INPUT_FILE /dev/null
+                OUTPUT_VARIABLE output
+                RESULT_VARIABLE status)
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+  message(FATAL_ERROR "Output of ${SCRIPT}:\n${output}\nExpected:\n${expected}")
+endif ()
+if (NOT status EQUAL 0)
+  message(FATAL_ERROR "${SCRIPT} exited with ${status}.")
+endif ()